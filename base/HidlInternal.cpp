@@ -21,10 +21,12 @@
 #include <android-base/logging.h>
 #include <cutils/properties.h>
 
+#include <stdint.h>
+#include <string.h>
+
 #ifdef LIBHIDL_TARGET_DEBUGGABLE
 #include <dirent.h>
 #include <dlfcn.h>
-#include <regex>
 #endif
 
 namespace android {
@@ -35,6 +37,157 @@ void logAlwaysFatal(const char *message) {
     LOG(FATAL) << message;
 }
 
+static inline bool isIdentifierStart(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static inline bool isIdentifierChar(char c) {
+    return isIdentifierStart(c) || (c >= '0' && c <= '9');
+}
+
+static inline bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// What '.' matches in an ECMAScript std::regex.
+static inline bool isRegexAny(char c) {
+    return c != '\n' && c != '\r';
+}
+
+static bool allRegexAny(const char* begin, const char* end) {
+    for (; begin != end; ++begin) {
+        if (!isRegexAny(*begin)) return false;
+    }
+    return true;
+}
+
+bool matchPassthroughLibraryName(const char* name, size_t length, size_t* fqPackageLength,
+                                 const char** suffix, size_t* suffixLength) {
+    static constexpr char kImpl[] = "-impl";
+    static constexpr size_t kImplLength = sizeof(kImpl) - 1;
+
+    size_t i = 0;
+
+    // package: identifiers separated by '.'
+    while (true) {
+        if (i >= length || !isIdentifierStart(name[i])) return false;
+        for (i++; i < length && isIdentifierChar(name[i]); i++) {}
+        if (i < length && name[i] == '.') {
+            i++;
+            continue;
+        }
+        break;
+    }
+
+    // @<major>.<minor>
+    if (i >= length || name[i] != '@') return false;
+    i++;
+    if (i >= length || !isDigit(name[i])) return false;
+    for (i++; i < length && isDigit(name[i]); i++) {}
+    if (i >= length || name[i] != '.') return false;
+    i++;
+    if (i >= length || !isDigit(name[i])) return false;
+    for (i++; i < length && isDigit(name[i]); i++) {}
+    const size_t fqEnd = i;
+
+    if (length - i < kImplLength || memcmp(name + i, kImpl, kImplLength) != 0) return false;
+    i += kImplLength;
+
+    // <suffix>, then any character (the regex's unescaped '.') and "so".
+    if (length - i < 3) return false;
+    const size_t suffixEnd = length - 3;
+    if (name[length - 2] != 's' || name[length - 1] != 'o') return false;
+    if (!allRegexAny(name + i, name + suffixEnd + 1)) return false;
+
+    *fqPackageLength = fqEnd;
+    *suffix = name + i;
+    *suffixLength = suffixEnd - i;
+    return true;
+}
+
+bool matchInstrumentationLibName(const char* name, size_t length,
+                                 const char* package, size_t packageLength) {
+    static constexpr char kProfiler[] = "profiler";
+    static constexpr size_t kProfilerLength = sizeof(kProfiler) - 1;
+    // any, "profiler", any, "so"
+    static constexpr size_t kTailLength = 1 + kProfilerLength + 1 + 2;
+
+    if (length < packageLength + kTailLength) return false;
+
+    // As with the regex this replaces, a '.' in package matches any character.
+    for (size_t i = 0; i < packageLength; i++) {
+        if (package[i] == '.' ? !isRegexAny(name[i]) : name[i] != package[i]) return false;
+    }
+
+    const char* tail = name + length - kTailLength;
+    return allRegexAny(name + packageLength, tail + 1) &&
+           memcmp(tail + 1, kProfiler, kProfilerLength) == 0 &&
+           isRegexAny(tail[1 + kProfilerLength]) &&
+           tail[kTailLength - 2] == 's' && tail[kTailLength - 1] == 'o';
+}
+
+// Has the high bit of a byte set unless that byte of the word at s is in
+// [0x01, 0x7f]. A zero byte borrows in the subtraction and sets its own high
+// bit; a non-ASCII byte already has it set.
+static inline uint64_t nulOrNonAsciiBits(const uint8_t* s) {
+    static constexpr uint64_t kOnes = 0x0101010101010101ULL;
+    static constexpr uint64_t kHighBits = 0x8080808080808080ULL;
+    uint64_t word;
+    memcpy(&word, s, sizeof(word));  // s need not be aligned
+    return ((word - kOnes) | word) & kHighBits;
+}
+
+bool isWellFormedString(const char* data, size_t size) {
+    const uint8_t* s = reinterpret_cast<const uint8_t*>(data);
+    const uint8_t* const end = s + size;
+
+    while (s < end) {
+        // Skip ASCII 32 bytes at a time, then 8, and only decode the rest.
+        while (end - s >= 32 && (nulOrNonAsciiBits(s) | nulOrNonAsciiBits(s + 8) |
+                                 nulOrNonAsciiBits(s + 16) | nulOrNonAsciiBits(s + 24)) == 0) {
+            s += 32;
+        }
+        while (end - s >= 8 && nulOrNonAsciiBits(s) == 0) {
+            s += 8;
+        }
+        if (s == end) break;
+
+        const uint8_t c = *s;
+        if (c == '\0') return false;
+        if (c < 0x80) {
+            s++;
+            continue;
+        }
+
+        // Length of the sequence, and the range its second byte must be in
+        // to rule out overlong forms, surrogates and code points > U+10FFFF.
+        size_t length;
+        uint8_t low = 0x80;
+        uint8_t high = 0xbf;
+        if (c >= 0xc2 && c <= 0xdf) {
+            length = 2;
+        } else if (c >= 0xe0 && c <= 0xef) {
+            length = 3;
+            if (c == 0xe0) low = 0xa0;
+            if (c == 0xed) high = 0x9f;
+        } else if (c >= 0xf0 && c <= 0xf4) {
+            length = 4;
+            if (c == 0xf0) low = 0x90;
+            if (c == 0xf4) high = 0x8f;
+        } else {
+            return false;
+        }
+
+        if (static_cast<size_t>(end - s) < length) return false;
+        if (s[1] < low || s[1] > high) return false;
+        for (size_t i = 2; i < length; i++) {
+            if (s[i] < 0x80 || s[i] > 0xbf) return false;
+        }
+        s += length;
+    }
+    return true;
+}
+
 // ----------------------------------------------------------------------
 // HidlInstrumentor implementation.
 HidlInstrumentor::HidlInstrumentor(const std::string& package, const std::string& interface)
@@ -148,9 +301,11 @@ void HidlInstrumentor::registerInstrumentationCallbacks(
 bool HidlInstrumentor::isInstrumentationLib(const dirent *file) {
 #ifdef LIBHIDL_TARGET_DEBUGGABLE
     if (file->d_type != DT_REG) return false;
-    std::cmatch cm;
-    std::regex e("^" + mInstrumentationLibPackage + "(.*).profiler.so$");
-    if (std::regex_match(file->d_name, cm, e)) return true;
+    if (matchInstrumentationLibName(file->d_name, strlen(file->d_name),
+                                    mInstrumentationLibPackage.c_str(),
+                                    mInstrumentationLibPackage.size())) {
+        return true;
+    }
 #else
     (void) file;
 #endif
@@ -24,22 +24,28 @@ namespace details {
 TaskRunner::TaskRunner() {
 }
 
-void TaskRunner::start(size_t limit) {
+void TaskRunner::start(size_t limit, size_t threads) {
     mQueue = std::make_shared<SynchronizedQueue<Task>>(limit);
-
-    // Allow the thread to continue running in background;
-    // TaskRunner do not care about the std::thread object.
-    std::thread{[q = mQueue] {
-        Task nextTask;
-        while (!!(nextTask = q->wait_pop())) {
-            nextTask();
-        }
-    }}.detach();
+    mThreads = threads;
+
+    // Allow the threads to continue running in background;
+    // TaskRunner do not care about the std::thread objects.
+    for (size_t i = 0; i < threads; i++) {
+        std::thread{[q = mQueue] {
+            Task nextTask;
+            while (!!(nextTask = q->wait_pop())) {
+                nextTask();
+            }
+        }}.detach();
+    }
 }
 
 TaskRunner::~TaskRunner() {
     if (mQueue) {
-        mQueue->push(nullptr);
+        // One for each thread.
+        for (size_t i = 0; i < mThreads; i++) {
+            mQueue->push(nullptr);
+        }
     }
 }
 
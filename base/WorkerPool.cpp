@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <hidl/WorkerPool.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+
+namespace android {
+namespace hardware {
+namespace details {
+
+static constexpr size_t kPoolThreads = 4;
+
+namespace {
+
+// One parallelFor call. Shared with the pool, since a pool thread may only
+// get to it after the caller has finished all of the work and returned.
+struct Job {
+    Job(size_t count, const std::function<void(size_t)> &fn) : count(count), fn(fn) {}
+
+    // Runs indices until there are none left. fn is only called for indices
+    // claimed before the caller returns, so whatever it refers to is alive.
+    void run() {
+        size_t ran = 0;
+        for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < count;) {
+            fn(i);
+            ran++;
+        }
+        if (ran > 0) {
+            std::unique_lock<std::mutex> lock(mutex);
+            finished += ran;
+            if (finished == count) {
+                condition.notify_all();
+            }
+        }
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [this] { return finished == count; });
+    }
+
+    const size_t count;
+    const std::function<void(size_t)> fn;
+    std::atomic<size_t> next{0};
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    size_t finished = 0;
+};
+
+class Pool {
+public:
+    Pool() {
+        for (size_t i = 0; i < kPoolThreads; i++) {
+            // Like TaskRunner, the threads run for the life of the process.
+            std::thread([this] { loop(); }).detach();
+        }
+    }
+
+    void post(const std::shared_ptr<Job> &job, size_t threads) {
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            for (size_t i = 0; i < threads; i++) {
+                mJobs.push(job);
+            }
+        }
+        mCondition.notify_all();
+    }
+
+private:
+    void loop() {
+        for (;;) {
+            std::shared_ptr<Job> job;
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mCondition.wait(lock, [this] { return !mJobs.empty(); });
+                job = std::move(mJobs.front());
+                mJobs.pop();
+            }
+            job->run();
+        }
+    }
+
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::queue<std::shared_ptr<Job>> mJobs;
+};
+
+}  // namespace
+
+void parallelFor(size_t count, size_t maxThreads, const std::function<void(size_t)> &fn) {
+    if (count == 0) {
+        return;
+    }
+    const size_t helpers = std::min({std::max<size_t>(maxThreads, 1), count, kPoolThreads + 1}) - 1;
+    if (helpers == 0) {
+        for (size_t i = 0; i < count; i++) {
+            fn(i);
+        }
+        return;
+    }
+
+    static Pool *pool = new Pool();
+
+    std::shared_ptr<Job> job = std::make_shared<Job>(count, fn);
+    pool->post(job, helpers);
+    job->run();
+    job->wait();
+}
+
+} // namespace details
+} // namespace hardware
+} // namespace android
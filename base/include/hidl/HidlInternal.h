@@ -109,6 +109,25 @@ private:
 #define HAL_LIBRARY_PATH_ODM    HAL_LIBRARY_PATH_ODM_32BIT
 #endif
 
+// Matches passthrough HAL library file names of the form
+// <package>@<major>.<minor>-impl<suffix>.so without allocating, accepting
+// exactly what the regex ([a-zA-Z_][a-zA-Z_0-9]*(?:[.][a-zA-Z_][a-zA-Z_0-9]*)*@[0-9]+[.][0-9]+)-impl(.*?).so
+// accepts. On a match, the first fqPackageLength characters of name are
+// <package>@<major>.<minor>, and suffix/suffixLength describe <suffix>.
+bool matchPassthroughLibraryName(const char* name, size_t length, size_t* fqPackageLength,
+                                 const char** suffix, size_t* suffixLength);
+
+// Matches instrumentation library file names of the form
+// <package><anything>.profiler.so without allocating, accepting exactly
+// what the regex ^<package>(.*).profiler.so$ accepts.
+bool matchInstrumentationLibName(const char* name, size_t length,
+                                 const char* package, size_t packageLength);
+
+// Returns true if data[0, size) is well-formed UTF-8 with no '\0' in it, in
+// a single pass. ASCII is checked a word at a time, so this runs at close
+// to memory bandwidth for the strings usually sent over HIDL.
+bool isWellFormedString(const char* data, size_t size);
+
 // ----------------------------------------------------------------------
 // Class that provides Hidl instrumentation utilities.
 struct HidlInstrumentor {
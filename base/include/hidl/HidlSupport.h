@@ -33,6 +33,10 @@
 #include <utils/StrongPointer.h>
 #include <vector>
 
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+
 namespace android {
 
 // this file is included by all hidl interface, so we must forward declare the
@@ -195,6 +199,16 @@ HIDL_STRING_OPERATOR(>=)
 // Send our content to the output stream
 std::ostream& operator<<(std::ostream& os, const hidl_string& str);
 
+#if __cplusplus >= 201703L
+// Borrow the contents of str without copying them, e.g. for a string read from
+// a Parcel. Only valid while str (and, if it references external data, that
+// data) is alive and unmodified. Not a member, so that hidl_string itself is
+// defined the same way for clients built as C++14 and as C++17.
+inline std::string_view toStringView(const hidl_string &str) {
+    return std::string_view(str.c_str(), str.size());
+}
+#endif
+
 
 // hidl_memory is a structure that can be used to transfer
 // pieces of shared memory between processes. The assumption
@@ -26,7 +26,7 @@ namespace details {
 
 /*
  * A background infinite loop that runs the Tasks push()'ed.
- * Equivalent to a simple single-threaded Looper.
+ * By default, equivalent to a simple single-threaded Looper.
  */
 class TaskRunner {
 public:
@@ -44,9 +44,10 @@ public:
 
     /*
      * Sets the queue limit. Fails the push operation once the limit is reached.
-     * Then kicks off the loop.
+     * Then kicks off the loop on threads background threads, which take the
+     * tasks in order; with more than one, tasks may run concurrently.
      */
-    void start(size_t limit);
+    void start(size_t limit, size_t threads = 1);
 
     /*
      * Add a task. Return true if successful, false if
@@ -56,6 +57,7 @@ public:
 
 private:
     std::shared_ptr<SynchronizedQueue<Task>> mQueue;
+    size_t mThreads = 0;
 };
 
 } // namespace details
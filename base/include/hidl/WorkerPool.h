@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef ANDROID_HIDL_WORKER_POOL_H
+#define ANDROID_HIDL_WORKER_POOL_H
+
+#include <stddef.h>
+#include <functional>
+
+namespace android {
+namespace hardware {
+namespace details {
+
+/*
+ * Calls fn(0), ..., fn(count - 1) on up to maxThreads threads, the calling
+ * thread included, and returns once every call has returned.
+ *
+ * The other threads come from a small process-wide pool that is started on
+ * first use and kept, so short parallel jobs don't create threads each time.
+ * If the pool is busy with other jobs, the calling thread does the work
+ * itself; parallelFor never waits for a pool thread to become free.
+ */
+void parallelFor(size_t count, size_t maxThreads, const std::function<void(size_t)> &fn);
+
+} // namespace details
+} // namespace hardware
+} // namespace android
+
+#endif // ANDROID_HIDL_WORKER_POOL_H
@@ -0,0 +1,405 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "LibHidlBenchmark"
+
+#include <benchmark/benchmark.h>
+#include <hidl/HidlBinderSupport.h>
+#include <hidl/HidlSupport.h>
+#include <hidl/LoopbackBinder.h>
+#include <hidl/MQDescriptor.h>
+#include <hidl/SocketTransport.h>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <regex>
+#include <string>
+#include <vector>
+
+#include "transport/allocator/1.0/default/AshmemAllocator.h"
+#include "transport/allocator/1.0/default/MemfdAllocator.h"
+
+using android::sp;
+using android::hardware::BHwBinder;
+using android::hardware::IBinder;
+using android::hardware::MQDescriptorSync;
+using android::hardware::Parcel;
+using android::hardware::Status;
+using android::hardware::hidl_memory;
+using android::hardware::hidl_string;
+using android::hardware::hidl_vec;
+using android::hardware::details::LoopbackBinder;
+using android::hardware::details::SocketServer;
+using android::hardware::details::connectToSocket;
+using android::hardware::details::matchInstrumentationLibName;
+using android::hardware::details::matchPassthroughLibraryName;
+using android::hardware::details::serveOnSocket;
+using android::hidl::allocator::V1_0::implementation::AshmemAllocator;
+using android::hidl::allocator::V1_0::implementation::MemfdAllocator;
+
+// A mix of the file names found in a typical HAL directory.
+static const std::vector<std::string> kLibraryNames = {
+    "android.hardware.audio@2.0-impl.so",
+    "android.hardware.audio.effect@2.0-impl.so",
+    "android.hardware.graphics.mapper@2.0-impl.so",
+    "android.hardware.camera.provider@2.4-impl-legacy.so",
+    "android.hardware.sensors@1.0-impl.so",
+    "android.hardware.sensors@1.0-IFoo-vts.profiler.so",
+    "android.hardware.light@2.0-service.so",
+    "libhwbinder.so",
+    "libc++.so",
+    "camera.msm8998.so",
+};
+
+static const std::string kProfilerPackage = "android.hardware.sensors@1.0";
+
+static void BM_PassthroughLibraryName_regex(benchmark::State& state) {
+    static const std::regex pattern(
+        "([a-zA-Z_][a-zA-Z_0-9]*(?:[.][a-zA-Z_][a-zA-Z_0-9]*)*@[0-9]+[.][0-9]+)-impl(.*?).so");
+    while (state.KeepRunning()) {
+        for (const std::string& name : kLibraryNames) {
+            std::smatch match;
+            benchmark::DoNotOptimize(std::regex_match(name, match, pattern));
+        }
+    }
+}
+BENCHMARK(BM_PassthroughLibraryName_regex);
+
+static void BM_PassthroughLibraryName_matcher(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        for (const std::string& name : kLibraryNames) {
+            size_t fqPackageLength;
+            const char* suffix;
+            size_t suffixLength;
+            benchmark::DoNotOptimize(matchPassthroughLibraryName(
+                name.c_str(), name.size(), &fqPackageLength, &suffix, &suffixLength));
+        }
+    }
+}
+BENCHMARK(BM_PassthroughLibraryName_matcher);
+
+// The old isInstrumentationLib built its regex once per directory entry.
+static void BM_InstrumentationLibName_regex(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        for (const std::string& name : kLibraryNames) {
+            std::regex pattern("^" + kProfilerPackage + "(.*).profiler.so$");
+            std::cmatch match;
+            benchmark::DoNotOptimize(std::regex_match(name.c_str(), match, pattern));
+        }
+    }
+}
+BENCHMARK(BM_InstrumentationLibName_regex);
+
+static void BM_InstrumentationLibName_matcher(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        for (const std::string& name : kLibraryNames) {
+            benchmark::DoNotOptimize(matchInstrumentationLibName(
+                name.c_str(), name.size(), kProfilerPackage.c_str(), kProfilerPackage.size()));
+        }
+    }
+}
+BENCHMARK(BM_InstrumentationLibName_matcher);
+
+// Strict hidl_string validation of 16 bytes to 64KiB of mostly-ASCII text.
+static void BM_WellFormedString(benchmark::State& state) {
+    std::string s(state.range(0), 'a');
+    s[s.size() / 2] = '\xc3';
+    s[s.size() / 2 + 1] = '\xa9';
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(
+            android::hardware::details::isWellFormedString(s.data(), s.size()));
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_WellFormedString)->RangeMultiplier(8)->Range(16, 64 << 10);
+
+// Writing a linked list of 16 to 4096 nodes whose last node points back at
+// the first, the way generated code writes pointers: each node's next
+// pointer is looked up among the buffers already in the Parcel.
+struct Node {
+    const Node* next;
+    uint64_t value;
+};
+
+template <typename FindBuffer>
+static void writeList(const std::vector<Node>& nodes, Parcel* parcel, FindBuffer findBuffer) {
+    size_t parentHandle;
+    parcel->writeBuffer(&nodes[0], sizeof(Node), &parentHandle);
+    for (const Node* node = &nodes[0];; node = node->next) {
+        bool found;
+        size_t childHandle, childOffset, handle;
+        findBuffer(parcel, node->next, &found, &childHandle, &childOffset);
+        if (found) {
+            parcel->writeEmbeddedReference(&handle, childHandle, childOffset, parentHandle,
+                                           offsetof(Node, next));
+            return;
+        }
+        parcel->writeEmbeddedBuffer(node->next, sizeof(Node), &handle, parentHandle,
+                                    offsetof(Node, next));
+        parentHandle = handle;
+    }
+}
+
+static std::vector<Node> makeList(size_t count) {
+    std::vector<Node> nodes(count);
+    for (size_t i = 0; i < count; i++) {
+        nodes[i] = {&nodes[(i + 1) % count], i};
+    }
+    return nodes;
+}
+
+static void BM_WriteReferences_findBuffer(benchmark::State& state) {
+    std::vector<Node> nodes = makeList(state.range(0));
+    while (state.KeepRunning()) {
+        Parcel parcel;
+        writeList(nodes, &parcel, [](Parcel* p, const Node* n, bool* found, size_t* handle,
+                                     size_t* offset) {
+            p->findBuffer(n, sizeof(Node), found, handle, offset);
+        });
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_WriteReferences_findBuffer)->RangeMultiplier(4)->Range(16, 4096);
+
+static void BM_WriteReferences_index(benchmark::State& state) {
+    std::vector<Node> nodes = makeList(state.range(0));
+    while (state.KeepRunning()) {
+        Parcel parcel;
+        android::hardware::details::ParcelBufferIndex index(&parcel);
+        writeList(nodes, &parcel, [&index](Parcel* p, const Node* n, bool* found, size_t* handle,
+                                           size_t* offset) {
+            index.findBuffer(p, n, sizeof(Node), found, handle, offset);
+        });
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_WriteReferences_index)->RangeMultiplier(4)->Range(16, 4096);
+
+// Marshalling of the core types through the loopback transport: written to a
+// Parcel, delivered as the binder driver would, and read back. The label is
+// the number of operator new calls per round trip; Parcel's own malloc()s
+// aren't counted.
+static std::atomic<uint64_t> gAllocations{0};
+
+void* operator new(size_t size) {
+    gAllocations.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(size);
+    if (p == nullptr) abort();
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+template <typename Write, typename Read>
+static void loopback(benchmark::State& state, Write write, Read read) {
+    const uint64_t allocations = gAllocations.load();
+    while (state.KeepRunning()) {
+        Parcel parcel;
+        write(&parcel);
+        Parcel delivered;
+        android::hardware::details::deliverParcel(parcel, &delivered);
+        read(delivered);
+    }
+    if (state.iterations() > 0) {
+        state.SetLabel(std::to_string((gAllocations.load() - allocations) / state.iterations()) +
+                       " new/op");
+    }
+}
+
+template <typename T>
+static const T* readTopLevel(const Parcel& parcel, size_t* handle) {
+    const void* out = nullptr;
+    parcel.readBuffer(sizeof(T), handle, &out);
+    return static_cast<const T*>(out);
+}
+
+static native_handle_t* makeHandle() {
+    native_handle_t* handle = native_handle_create(1 /* numFds */, 0 /* numInts */);
+    handle->data[0] = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    return handle;
+}
+
+static void BM_Loopback_string(benchmark::State& state) {
+    const hidl_string string(std::string(64, 'x'));
+    loopback(state,
+        [&](Parcel* parcel) {
+            size_t handle;
+            parcel->writeBuffer(&string, sizeof(string), &handle);
+            writeEmbeddedToParcel(string, parcel, handle, 0 /* parentOffset */);
+        },
+        [](const Parcel& parcel) {
+            size_t handle;
+            const hidl_string* read = readTopLevel<hidl_string>(parcel, &handle);
+            readEmbeddedFromParcel(*read, parcel, handle, 0 /* parentOffset */);
+        });
+}
+BENCHMARK(BM_Loopback_string);
+
+static void BM_Loopback_vec(benchmark::State& state) {
+    hidl_vec<uint8_t> vec;
+    vec.resize(1024);
+    loopback(state,
+        [&](Parcel* parcel) {
+            size_t handle;
+            size_t childHandle;
+            parcel->writeBuffer(&vec, sizeof(vec), &handle);
+            writeEmbeddedToParcel(vec, parcel, handle, 0 /* parentOffset */, &childHandle);
+        },
+        [](const Parcel& parcel) {
+            size_t handle;
+            size_t childHandle;
+            const hidl_vec<uint8_t>* read = readTopLevel<hidl_vec<uint8_t>>(parcel, &handle);
+            readEmbeddedFromParcel(*read, parcel, handle, 0 /* parentOffset */, &childHandle);
+        });
+}
+BENCHMARK(BM_Loopback_vec);
+
+static void BM_Loopback_memory(benchmark::State& state) {
+    native_handle_t* handle = makeHandle();
+    const hidl_memory memory("ashmem", handle, 4096);
+    loopback(state,
+        [&](Parcel* parcel) {
+            size_t parentHandle;
+            parcel->writeBuffer(&memory, sizeof(memory), &parentHandle);
+            writeEmbeddedToParcel(memory, parcel, parentHandle, 0 /* parentOffset */);
+        },
+        [](const Parcel& parcel) {
+            size_t parentHandle;
+            const hidl_memory* read = readTopLevel<hidl_memory>(parcel, &parentHandle);
+            readEmbeddedFromParcel(*read, parcel, parentHandle, 0 /* parentOffset */);
+        });
+    native_handle_close(handle);
+    native_handle_delete(handle);
+}
+BENCHMARK(BM_Loopback_memory);
+
+static void BM_Loopback_MQDescriptor(benchmark::State& state) {
+    const MQDescriptorSync<uint8_t> descriptor(4096 /* bufferSize */, makeHandle(),
+                                               1 /* messageSize */);
+    loopback(state,
+        [&](Parcel* parcel) {
+            size_t handle;
+            parcel->writeBuffer(&descriptor, sizeof(descriptor), &handle);
+            writeEmbeddedToParcel(descriptor, parcel, handle, 0 /* parentOffset */);
+        },
+        [](const Parcel& parcel) {
+            size_t handle;
+            const MQDescriptorSync<uint8_t>* read =
+                readTopLevel<MQDescriptorSync<uint8_t>>(parcel, &handle);
+            readEmbeddedFromParcel(const_cast<MQDescriptorSync<uint8_t>&>(*read), parcel,
+                                   handle, 0 /* parentOffset */);
+        });
+}
+BENCHMARK(BM_Loopback_MQDescriptor);
+
+static void BM_Loopback_Status(benchmark::State& state) {
+    const Status status = Status::fromExceptionCode(Status::EX_SECURITY, "Permission denied");
+    loopback(state,
+        [&](Parcel* parcel) {
+            writeToParcel(status, parcel);
+        },
+        [](const Parcel& parcel) {
+            Status read;
+            readFromParcel(&read, parcel);
+        });
+}
+BENCHMARK(BM_Loopback_Status);
+
+// Replies with the string it is sent.
+struct EchoBinder : public BHwBinder {
+    android::status_t onTransact(uint32_t /* code */, const Parcel& data, Parcel* reply,
+                                 uint32_t /* flags */, TransactCallback callback) override {
+        size_t handle;
+        const hidl_string* read = readTopLevel<hidl_string>(data, &handle);
+        if (read == nullptr) return android::BAD_VALUE;
+        readEmbeddedFromParcel(*read, data, handle, 0 /* parentOffset */);
+        reply->writeBuffer(read, sizeof(*read), &handle);
+        writeEmbeddedToParcel(*read, reply, handle, 0 /* parentOffset */);
+        callback(*reply);
+        return android::OK;
+    }
+};
+
+// Transactions of strings of 64 bytes to 1MiB, sent to an EchoBinder through
+// remote. Above 32KiB, the socket transport passes Parcels in a memfd.
+static void roundTrip(benchmark::State& state, const sp<IBinder>& remote) {
+    const hidl_string string(std::string(state.range(0), 'x'));
+    while (state.KeepRunning()) {
+        Parcel data;
+        size_t handle;
+        data.writeBuffer(&string, sizeof(string), &handle);
+        writeEmbeddedToParcel(string, &data, handle, 0 /* parentOffset */);
+        remote->transact(0, data, nullptr, 0 /* flags */, [](Parcel& reply) {
+            size_t handle;
+            const hidl_string* read = readTopLevel<hidl_string>(reply, &handle);
+            readEmbeddedFromParcel(*read, reply, handle, 0 /* parentOffset */);
+        });
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0) * 2);
+}
+
+static void BM_RoundTrip_loopback(benchmark::State& state) {
+    roundTrip(state, new LoopbackBinder(new EchoBinder()));
+}
+BENCHMARK(BM_RoundTrip_loopback)->RangeMultiplier(64)->Range(64, 1 << 20);
+
+static void BM_RoundTrip_socket(benchmark::State& state) {
+    const std::string path = "@libhidl_benchmark_" + std::to_string(getpid());
+    std::unique_ptr<SocketServer> server = serveOnSocket(path, new EchoBinder());
+    sp<IBinder> remote = connectToSocket(path);
+    if (server == nullptr || remote == nullptr) {
+        state.SkipWithError("Could not serve on a socket.");
+        return;
+    }
+    roundTrip(state, remote);
+}
+BENCHMARK(BM_RoundTrip_socket)->RangeMultiplier(64)->Range(64, 1 << 20);
+
+// Batches of 1 to 4096 regions, allocated one by one...
+template <typename Allocator>
+static void BM_Allocate_serial(benchmark::State& state) {
+    sp<Allocator> allocator = new Allocator();
+    while (state.KeepRunning()) {
+        for (int64_t i = 0; i < state.range(0); i++) {
+            allocator->allocate(4096, [](bool, const hidl_memory&) {});
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK_TEMPLATE(BM_Allocate_serial, AshmemAllocator)->RangeMultiplier(4)->Range(1, 4096);
+BENCHMARK_TEMPLATE(BM_Allocate_serial, MemfdAllocator)->RangeMultiplier(4)->Range(1, 4096);
+
+// ...and in one batch, which allocates on the shared worker pool.
+template <typename Allocator>
+static void BM_Allocate_batch(benchmark::State& state) {
+    sp<Allocator> allocator = new Allocator();
+    while (state.KeepRunning()) {
+        allocator->batchAllocatePartial(4096, state.range(0),
+            [](const hidl_vec<bool>&, const hidl_vec<hidl_memory>&) {});
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK_TEMPLATE(BM_Allocate_batch, AshmemAllocator)->RangeMultiplier(4)->Range(1, 4096);
+BENCHMARK_TEMPLATE(BM_Allocate_batch, MemfdAllocator)->RangeMultiplier(4)->Range(1, 4096);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define LOG_TAG "libhidlmemory"
+
+#include <hidlmemory/MemoryHeap.h>
+
+#include <stdint.h>
+
+#include <algorithm>
+
+#include <android-base/logging.h>
+#include <hidlmemory/mapping.h>
+
+using android::hidl::allocator::V1_0::IAllocator;
+using android::hidl::memory::V1_0::IMemory;
+
+namespace android {
+namespace hardware {
+
+constexpr uint64_t MemoryHeap::kMinBlockSize;
+
+static uint64_t blockSize(size_t order) {
+    return MemoryHeap::kMinBlockSize << order;
+}
+
+// Smallest order whose blocks have at least size bytes.
+static size_t orderFor(uint64_t size) {
+    size_t order = 0;
+    while (blockSize(order) < size) {
+        order++;
+    }
+    return order;
+}
+
+MemoryBlock::MemoryBlock(const sp<MemoryHeap>& heap, uint64_t offset, uint64_t size,
+                         size_t order)
+    : mHeap(heap), mOffset(offset), mSize(size), mOrder(order) {}
+
+MemoryBlock::~MemoryBlock() {
+    mHeap->free(mOffset, mOrder);
+}
+
+const hidl_memory& MemoryBlock::memory() const {
+    return mHeap->memory();
+}
+
+void* MemoryBlock::pointer() const {
+    return static_cast<uint8_t*>(mHeap->pointer()) + mOffset;
+}
+
+sp<MemoryHeap> MemoryHeap::create(const sp<IAllocator>& allocator, uint64_t size) {
+    if (allocator == nullptr || size == 0 || size > (UINT64_MAX >> 1)) {
+        return nullptr;
+    }
+
+    size_t maxOrder = orderFor(size);
+    hidl_memory memory;
+    Return<void> ret = allocator->allocate(blockSize(maxOrder),
+        [&](bool success, const hidl_memory& mem) {
+            if (success) {
+                memory = mem;
+            }
+        });
+    if (!ret.isOk() || memory.handle() == nullptr) {
+        LOG(ERROR) << "Could not allocate " << blockSize(maxOrder) << " bytes for a MemoryHeap.";
+        return nullptr;
+    }
+
+    sp<IMemory> mapped = mapMemory(memory);
+    if (mapped == nullptr) {
+        LOG(ERROR) << "Could not map MemoryHeap memory.";
+        return nullptr;
+    }
+
+    return new MemoryHeap(memory, mapped, maxOrder);
+}
+
+MemoryHeap::MemoryHeap(const hidl_memory& memory, const sp<IMemory>& mapped, size_t maxOrder)
+    : mMemory(memory),
+      mMapped(mapped),
+      mBase(mapped->getPointer()),
+      mMaxOrder(maxOrder),
+      mFreeBlocks(maxOrder + 1),
+      mAvailable(blockSize(maxOrder)) {
+    mFreeBlocks[maxOrder].insert(0);
+}
+
+sp<MemoryBlock> MemoryHeap::allocate(uint64_t size) {
+    if (size == 0 || size > blockSize(mMaxOrder)) {
+        return nullptr;
+    }
+    size_t order = orderFor(size);
+
+    uint64_t offset;
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+
+        size_t available = order;
+        while (available <= mMaxOrder && mFreeBlocks[available].empty()) {
+            available++;
+        }
+        if (available > mMaxOrder) {
+            return nullptr;
+        }
+
+        offset = *mFreeBlocks[available].begin();
+        mFreeBlocks[available].erase(mFreeBlocks[available].begin());
+
+        // Split until the block is the requested order, freeing the upper
+        // halves.
+        while (available > order) {
+            available--;
+            mFreeBlocks[available].insert(offset + blockSize(available));
+        }
+        mAvailable -= blockSize(order);
+    }
+
+    return new MemoryBlock(this, offset, size, order);
+}
+
+bool MemoryHeap::isHandedOutLocked(uint64_t offset, size_t order) const {
+    if (order > mMaxOrder || offset >= blockSize(mMaxOrder) || offset % blockSize(order) != 0) {
+        return false;
+    }
+
+    // No part of the block may be free: not a larger free block containing
+    // it, nor a smaller one inside it.
+    for (size_t i = 0; i <= mMaxOrder; i++) {
+        const std::set<uint64_t>& blocks = mFreeBlocks[i];
+        if (i >= order) {
+            if (blocks.count(offset & ~(blockSize(i) - 1)) != 0) {
+                return false;
+            }
+        } else {
+            auto it = blocks.lower_bound(offset);
+            if (it != blocks.end() && *it < offset + blockSize(order)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool MemoryHeap::free(uint64_t offset, size_t order) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    if (!isHandedOutLocked(offset, order)) {
+        LOG(ERROR) << "Ignoring free of block of order " << order << " at " << offset
+                   << ", which isn't handed out.";
+        return false;
+    }
+    mAvailable += blockSize(order);
+
+    // Merge with the buddy for as long as it is free too.
+    while (order < mMaxOrder) {
+        uint64_t buddy = offset ^ blockSize(order);
+        auto it = mFreeBlocks[order].find(buddy);
+        if (it == mFreeBlocks[order].end()) {
+            break;
+        }
+        mFreeBlocks[order].erase(it);
+        offset = std::min(offset, buddy);
+        order++;
+    }
+    mFreeBlocks[order].insert(offset);
+    return true;
+}
+
+uint64_t MemoryHeap::available() const {
+    std::unique_lock<std::mutex> lock(mMutex);
+    return mAvailable;
+}
+
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_HIDL_MEMORY_HEAP_H
+#define ANDROID_HARDWARE_HIDL_MEMORY_HEAP_H
+
+#include <mutex>
+#include <set>
+#include <vector>
+
+#include <android/hidl/allocator/1.0/IAllocator.h>
+#include <android/hidl/memory/1.0/IMemory.h>
+#include <hidl/HidlSupport.h>
+#include <utils/RefBase.h>
+
+namespace android {
+namespace hardware {
+
+class MemoryHeap;
+
+/**
+ * A slice of a MemoryHeap. It is returned to the heap when the last reference
+ * to it goes away.
+ *
+ * To share it, send memory(), offset() and size(). The receiver can map just
+ * the slice with mapMemory(memory, offset, size).
+ */
+class MemoryBlock : public virtual RefBase {
+public:
+    ~MemoryBlock();
+
+    // The whole region of the heap this block is part of.
+    const hidl_memory& memory() const;
+    uint64_t offset() const { return mOffset; }
+    uint64_t size() const { return mSize; }
+    void* pointer() const;
+
+private:
+    friend class MemoryHeap;
+    MemoryBlock(const sp<MemoryHeap>& heap, uint64_t offset, uint64_t size, size_t order);
+
+    const sp<MemoryHeap> mHeap;
+    const uint64_t mOffset;
+    const uint64_t mSize;
+    const size_t mOrder;
+};
+
+/**
+ * Hands out many small blocks of shared memory from one allocated and mapped
+ * region, instead of one region (and fd, and mapping) per buffer.
+ *
+ * Blocks are managed as a buddy system: sizes are rounded up to a power of
+ * two of at least kMinBlockSize, and each block is aligned to its size.
+ *
+ * E.x.:
+ *     sp<MemoryHeap> heap = MemoryHeap::create(IAllocator::getService("ashmem"), 1 << 20);
+ *     sp<MemoryBlock> block = heap->allocate(256);
+ */
+class MemoryHeap : public virtual RefBase {
+public:
+    static constexpr uint64_t kMinBlockSize = 64;
+
+    /**
+     * Allocates a region of at least size bytes (rounded up to a power of two)
+     * from allocator and maps it. Returns nullptr on failure.
+     */
+    static sp<MemoryHeap> create(const sp<hidl::allocator::V1_0::IAllocator>& allocator,
+                                 uint64_t size);
+
+    /**
+     * Returns a block of at least size bytes, or nullptr if the heap doesn't
+     * have a large enough free block.
+     */
+    sp<MemoryBlock> allocate(uint64_t size);
+
+    const hidl_memory& memory() const { return mMemory; }
+    void* pointer() const { return mBase; }
+    uint64_t size() const { return mMemory.size(); }
+
+    // Bytes not handed out, although possibly fragmented.
+    uint64_t available() const;
+
+private:
+    friend class MemoryBlock;
+    friend class MemoryHeapTest;
+    MemoryHeap(const hidl_memory& memory, const sp<hidl::memory::V1_0::IMemory>& mapped,
+               size_t maxOrder);
+
+    // Returns the block of order at offset to the heap. Returns false, and
+    // leaves the heap as is, if that isn't a block that is handed out.
+    bool free(uint64_t offset, size_t order);
+    // Must hold mMutex.
+    bool isHandedOutLocked(uint64_t offset, size_t order) const;
+
+    const hidl_memory mMemory;
+    const sp<hidl::memory::V1_0::IMemory> mMapped;
+    void* const mBase;
+    const size_t mMaxOrder;  // the whole heap is a single block of this order
+
+    mutable std::mutex mMutex;
+    // Offsets of the free blocks of each order, where a block of order i has
+    // kMinBlockSize << i bytes.
+    std::vector<std::set<uint64_t>> mFreeBlocks;
+    uint64_t mAvailable;
+};
+
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_HIDL_MEMORY_HEAP_H
@@ -25,5 +25,38 @@ namespace hardware {
  */
 sp<android::hidl::memory::V1_0::IMemory> mapMemory(const hidl_memory &memory);
 
+/**
+ * Maps length bytes of memory starting at offset, which need not be page
+ * aligned, e.x. to read a header out of a much larger region. The returned
+ * IMemory's pointer refers to the byte at offset and its size is length. With
+ * readOnly, the range is mapped without write access.
+ *
+ * Requires a mapper that implements android.hidl.memory@1.1::IMapper. These
+ * mappings don't go through the mapping cache. Returns nullptr on failure.
+ */
+sp<android::hidl::memory::V1_0::IMemory> mapMemory(const hidl_memory &memory,
+                                                   uint64_t offset, uint64_t length,
+                                                   bool readOnly = false);
+
+/**
+ * Makes mapMemory share mappings. Mapping the same region again (e.x. a buffer
+ * that is sent with every request) returns the IMemory already mapping it,
+ * instead of mapping it again. Regions are identified by the device and inode
+ * of their file and their size, so only memory backed by a regular file
+ * (e.x. memfd) is cached; ashmem fds all refer to one device and are always
+ * mapped anew. Up to maxMappings of the most recently used
+ * regions are kept mapped, even while no IMemory refers to them. A region is
+ * unmapped once it is evicted and the last IMemory for it is released.
+ *
+ * Off by default. A capacity of 0 turns it off again.
+ */
+void setMappingCacheCapacity(size_t maxMappings);
+
+/**
+ * Evicts every cached mapping, e.x. when the process is under memory
+ * pressure. Mappings still in use stay mapped until they are released.
+ */
+void trimMappingCache();
+
 }  // namespace hardware
 }  // namespace android
@@ -15,42 +15,167 @@
  */
 #define LOG_TAG "libhidlmemory"
 
+#include <string.h>
+#include <sys/stat.h>
+
+#include <atomic>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <tuple>
+#include <vector>
 
 #include <hidlmemory/mapping.h>
 
 #include <android-base/logging.h>
 #include <android/hidl/memory/1.0/IMapper.h>
+#include <android/hidl/memory/1.1/IMapper.h>
 #include <hidl/HidlSupport.h>
 
 using android::sp;
 using android::hidl::memory::V1_0::IMemory;
 using android::hidl::memory::V1_0::IMapper;
+using IMapper1_1 = android::hidl::memory::V1_1::IMapper;
 
 namespace android {
 namespace hardware {
 
-static std::map<std::string, sp<IMapper>> gMappersByName;
+// Mappers are looked up by the name of the memory on every mapMemory call, so
+// the common case of an already-fetched mapper takes no locks: mappers are
+// published into a small fixed table once fetched, and never removed. Only
+// successful fetches are published, so names that don't have a mapper (which
+// a peer can put in any hidl_memory) can't fill the table. Fetching a mapper
+// only holds that name's lock, so mapping a new type of memory doesn't stall
+// mapping others.
+struct MapperEntry {
+    MapperEntry(const std::string& name, const sp<IMapper>& mapper)
+            : name(name), mapper(mapper), mapper1_1(IMapper1_1::castFrom(mapper)) {}
+
+    const std::string name;
+    const sp<IMapper> mapper;
+    // nullptr if the mapper doesn't implement 1.1.
+    const sp<IMapper1_1> mapper1_1;
+};
+
+// There are only a handful of memory types (e.x. ashmem), so this is plenty.
+// Slots are filled in order, under gMutex.
+static constexpr size_t kMaxMapperEntries = 16;
+static std::atomic<const MapperEntry*> gMapperEntries[kMaxMapperEntries];
+
 static std::mutex gMutex;
+// Guarded by gMutex. Mappers fetched once the table is full.
+static std::map<std::string, std::unique_ptr<const MapperEntry>> gOverflowMapperEntries;
+// Guarded by gMutex. Serializes fetching each name.
+static std::map<std::string, std::shared_ptr<std::mutex>> gFetchMutexes;
 
-static inline sp<IMapper> getMapperService(const std::string& name) {
-    std::unique_lock<std::mutex> _lock(gMutex);
-    auto iter = gMappersByName.find(name);
-    if (iter != gMappersByName.end()) {
-        return iter->second;
+static inline bool nameEquals(const MapperEntry* entry, const hidl_string& name) {
+    return entry->name.size() == name.size() &&
+           memcmp(entry->name.data(), name.c_str(), name.size()) == 0;
+}
+
+static inline const MapperEntry* findMapperEntry(const hidl_string& name) {
+    for (const std::atomic<const MapperEntry*>& slot : gMapperEntries) {
+        const MapperEntry* entry = slot.load(std::memory_order_acquire);
+        if (entry == nullptr) {
+            return nullptr;
+        }
+        if (nameEquals(entry, name)) {
+            return entry;
+        }
+    }
+    return nullptr;
+}
+
+// Must hold gMutex.
+static const MapperEntry* findOverflowMapperEntryLocked(const std::string& name) {
+    auto it = gOverflowMapperEntries.find(name);
+    return it == gOverflowMapperEntries.end() ? nullptr : it->second.get();
+}
+
+// Must hold gMutex.
+static const MapperEntry* publishMapperEntryLocked(std::unique_ptr<const MapperEntry> entry) {
+    for (std::atomic<const MapperEntry*>& slot : gMapperEntries) {
+        if (slot.load(std::memory_order_relaxed) == nullptr) {
+            const MapperEntry* published = entry.release();
+            slot.store(published, std::memory_order_release);
+            return published;
+        }
+    }
+    const MapperEntry* published = entry.get();
+    gOverflowMapperEntries.emplace(published->name, std::move(entry));
+    return published;
+}
+
+static const MapperEntry* fetchMapperEntry(const hidl_string& hidlName) {
+    const std::string name = hidlName;
+    std::shared_ptr<std::mutex> fetchMutex;
+    {
+        std::unique_lock<std::mutex> _lock(gMutex);
+        const MapperEntry* entry = findOverflowMapperEntryLocked(name);
+        if (entry != nullptr) {
+            return entry;
+        }
+        std::shared_ptr<std::mutex>& mutex = gFetchMutexes[name];
+        if (mutex == nullptr) {
+            mutex = std::make_shared<std::mutex>();
+        }
+        fetchMutex = mutex;
+    }
+
+    std::unique_lock<std::mutex> _fetchLock(*fetchMutex);
+    // Another thread may have fetched it while this one waited.
+    const MapperEntry* entry = findMapperEntry(hidlName);
+    if (entry != nullptr) {
+        return entry;
+    }
+    {
+        std::unique_lock<std::mutex> _lock(gMutex);
+        entry = findOverflowMapperEntryLocked(name);
+        if (entry != nullptr) {
+            return entry;
+        }
     }
 
     sp<IMapper> mapper = IMapper::getService(name, true /* getStub */);
+    // Built here, as castFrom can call into the mapper, and only published
+    // under gMutex.
+    std::unique_ptr<const MapperEntry> fetched;
     if (mapper != nullptr) {
-        gMappersByName[name] = mapper;
+        fetched.reset(new MapperEntry(name, mapper));
+    }
+
+    std::unique_lock<std::mutex> _lock(gMutex);
+    // Failures aren't remembered, so that the next call tries again.
+    auto it = gFetchMutexes.find(name);
+    if (it != gFetchMutexes.end() && it->second == fetchMutex) {
+        gFetchMutexes.erase(it);
     }
-    return mapper;
+    if (fetched == nullptr) {
+        return nullptr;
+    }
+    return publishMapperEntryLocked(std::move(fetched));
 }
 
-sp<IMemory> mapMemory(const hidl_memory& memory) {
+static inline const MapperEntry* getMapperEntry(const hidl_string& name) {
+    const MapperEntry* entry = findMapperEntry(name);
+    if (entry != nullptr) {
+        return entry;
+    }
+    return fetchMapperEntry(name);
+}
 
+static inline sp<IMapper> getMapperService(const hidl_string& name) {
+    const MapperEntry* entry = getMapperEntry(name);
+    return entry == nullptr ? nullptr : entry->mapper;
+}
+
+static inline sp<IMapper1_1> getMapper1_1Service(const hidl_string& name) {
+    const MapperEntry* entry = getMapperEntry(name);
+    return entry == nullptr ? nullptr : entry->mapper1_1;
+}
+
+static sp<IMemory> mapMemoryUncached(const hidl_memory& memory) {
     sp<IMapper> mapper = getMapperService(memory.name());
 
     if (mapper == nullptr) {
@@ -73,5 +198,139 @@ sp<IMemory> mapMemory(const hidl_memory& memory) {
     return ret;
 }
 
+// Identifies the region a hidl_memory refers to, regardless of which fd (or
+// which process's copy of it) it arrived through. Only regions backed by a
+// file of their own (e.x. memfd) have one: every ashmem fd is the same
+// /dev/ashmem device inode, so two ashmem regions of the same name and size
+// can't be told apart, and aren't cached.
+struct MappingKey {
+    std::string name;
+    dev_t dev;
+    ino_t ino;
+    uint64_t size;
+
+    bool operator<(const MappingKey& other) const {
+        return std::tie(dev, ino, size, name) <
+               std::tie(other.dev, other.ino, other.size, other.name);
+    }
+};
+
+struct CachedMapping {
+    sp<IMemory> memory;
+    uint64_t lastUse;
+};
+
+static std::mutex gMappingCacheMutex;
+static size_t gMappingCacheCapacity = 0;  // disabled by default
+static uint64_t gMappingCacheClock = 0;
+static std::map<MappingKey, CachedMapping> gMappingCache;
+
+static bool getMappingKey(const hidl_memory& memory, MappingKey* key) {
+    const native_handle_t* handle = memory.handle();
+    if (handle == nullptr || handle->numFds == 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(handle->data[0], &st) != 0 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+
+    key->name = memory.name();
+    key->dev = st.st_dev;
+    key->ino = st.st_ino;
+    key->size = memory.size();
+    return true;
+}
+
+// Must hold gMappingCacheMutex. Evicted mappings are moved to evicted so that
+// the caller can release them, and possibly munmap, after unlocking.
+static void evictLeastRecentlyUsedMappingsLocked(size_t maxMappings,
+                                                 std::vector<sp<IMemory>>* evicted) {
+    while (gMappingCache.size() > maxMappings) {
+        auto oldest = gMappingCache.begin();
+        for (auto it = gMappingCache.begin(); it != gMappingCache.end(); ++it) {
+            if (it->second.lastUse < oldest->second.lastUse) {
+                oldest = it;
+            }
+        }
+        evicted->push_back(std::move(oldest->second.memory));
+        gMappingCache.erase(oldest);
+    }
+}
+
+void setMappingCacheCapacity(size_t maxMappings) {
+    std::vector<sp<IMemory>> evicted;
+    std::unique_lock<std::mutex> _lock(gMappingCacheMutex);
+    gMappingCacheCapacity = maxMappings;
+    evictLeastRecentlyUsedMappingsLocked(maxMappings, &evicted);
+}
+
+void trimMappingCache() {
+    std::vector<sp<IMemory>> evicted;
+    std::unique_lock<std::mutex> _lock(gMappingCacheMutex);
+    evictLeastRecentlyUsedMappingsLocked(0, &evicted);
+}
+
+sp<IMemory> mapMemory(const hidl_memory& memory) {
+    MappingKey key;
+    bool cacheable;
+    {
+        std::unique_lock<std::mutex> _lock(gMappingCacheMutex);
+        cacheable = gMappingCacheCapacity > 0 && getMappingKey(memory, &key);
+        if (cacheable) {
+            auto it = gMappingCache.find(key);
+            if (it != gMappingCache.end()) {
+                it->second.lastUse = ++gMappingCacheClock;
+                return it->second.memory;
+            }
+        }
+    }
+
+    sp<IMemory> mapped = mapMemoryUncached(memory);
+    if (!cacheable || mapped == nullptr) {
+        return mapped;
+    }
+
+    // Whoever mapped the region first wins, so that all users share one mapping.
+    std::vector<sp<IMemory>> evicted;
+    std::unique_lock<std::mutex> _lock(gMappingCacheMutex);
+    if (gMappingCacheCapacity == 0) {
+        return mapped;
+    }
+    auto inserted = gMappingCache.emplace(key, CachedMapping{mapped, ++gMappingCacheClock});
+    if (!inserted.second) {
+        evicted.push_back(mapped);
+        inserted.first->second.lastUse = gMappingCacheClock;
+        mapped = inserted.first->second.memory;
+    }
+    evictLeastRecentlyUsedMappingsLocked(gMappingCacheCapacity, &evicted);
+    return mapped;
+}
+
+sp<IMemory> mapMemory(const hidl_memory& memory, uint64_t offset, uint64_t length,
+                      bool readOnly) {
+    sp<IMapper1_1> mapper = getMapper1_1Service(memory.name());
+
+    if (mapper == nullptr) {
+        LOG(ERROR) << "Could not fetch 1.1 mapper for " << memory.name() << " shared memory";
+        return nullptr;
+    }
+
+    if (mapper->isRemote()) {
+        LOG(ERROR) << "IMapper must be a passthrough service.";
+        return nullptr;
+    }
+
+    Return<sp<IMemory>> ret = mapper->mapMemoryRange(memory, offset, length, readOnly);
+
+    if (!ret.isOk()) {
+        LOG(ERROR) << "hidl_memory map returned transport error.";
+        return nullptr;
+    }
+
+    return ret;
+}
+
 }  // namespace hardware
 }  // namespace android
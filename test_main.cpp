@@ -17,13 +17,42 @@
 #define LOG_TAG "LibHidlTest"
 
 #include <android-base/logging.h>
+#include <android/hidl/allocator/1.0/BnHwAllocator.h>
+#include <android/hidl/allocator/1.0/BpHwAllocator.h>
+#include <cutils/ashmem.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
+#include <hidl/HidlBinderSupport.h>
 #include <hidl/HidlSupport.h>
+#include <hidl/LoopbackBinder.h>
+#include <hidl/SocketTransport.h>
 #include <hidl/Status.h>
 #include <hidl/TaskRunner.h>
+#include <hidlmemory/MemoryHeap.h>
+#include <hidlmemory/mapping.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <random>
+#include <regex>
+#include <thread>
 #include <vector>
 
+#include <fcntl.h>
+#include <linux/memfd.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "transport/PassthroughClientReporter.h"
+#include "transport/allocator/1.0/default/AshmemAllocator.h"
+#include "transport/allocator/1.0/default/MemfdAllocator.h"
+#include "transport/allocator/1.0/default/RegionPool.h"
+#include "transport/memory/1.0/default/MemfdMapper.h"
+
 #define EXPECT_ARRAYEQ(__a1__, __a2__, __size__) EXPECT_TRUE(isArrayEqual(__a1__, __a2__, __size__))
 #define EXPECT_2DARRAYEQ(__a1__, __a2__, __size1__, __size2__) \
         EXPECT_TRUE(is2dArrayEqual(__a1__, __a2__, __size1__, __size2__))
@@ -309,6 +338,61 @@ TEST_F(LibHidlTest, TaskRunnerTest) {
     EXPECT_TRUE(flag);
 }
 
+TEST_F(LibHidlTest, TaskRunnerThreadsTest) {
+    using android::hardware::details::TaskRunner;
+    TaskRunner tr;
+    tr.start(2 /* limit */, 2 /* threads */);
+
+    // Each task waits for the other, so they only finish if they run at once.
+    std::mutex mutex;
+    std::condition_variable condition;
+    size_t started = 0;
+    size_t finished = 0;
+    auto task = [&] {
+        std::unique_lock<std::mutex> lock(mutex);
+        started++;
+        condition.notify_all();
+        if (condition.wait_for(lock, std::chrono::seconds(5), [&] { return started == 2; })) {
+            finished++;
+            condition.notify_all();
+        }
+    };
+    ASSERT_TRUE(tr.push(task));
+    ASSERT_TRUE(tr.push(task));
+
+    std::unique_lock<std::mutex> lock(mutex);
+    EXPECT_TRUE(condition.wait_for(lock, std::chrono::seconds(10), [&] { return finished == 2; }));
+}
+
+TEST_F(LibHidlTest, PassthroughClientReporterRetryTest) {
+    using android::hardware::details::PassthroughClientReporter;
+    using namespace std::chrono_literals;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    size_t attempts = 0;
+    std::vector<std::string> sent;
+    PassthroughClientReporter reporter(
+            [&](const std::string &interfaceName, const std::string &instanceName) {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (++attempts == 1) {
+                    return false;
+                }
+                sent.push_back(interfaceName + "/" + instanceName);
+                condition.notify_all();
+                return true;
+            },
+            10ms /* initialBackoff */, 1s /* maxBackoff */);
+
+    // Nothing else is reported, so only the retry can send it.
+    reporter.report("android.hardware.foo@1.0::IFoo", "default");
+
+    std::unique_lock<std::mutex> lock(mutex);
+    ASSERT_TRUE(condition.wait_for(lock, 5s, [&] { return !sent.empty(); }));
+    EXPECT_EQ(2u, attempts);
+    EXPECT_EQ(std::vector<std::string>{"android.hardware.foo@1.0::IFoo/default"}, sent);
+}
+
 TEST_F(LibHidlTest, StringCmpTest) {
     using android::hardware::hidl_string;
     const char * s = "good";
@@ -433,6 +517,947 @@ TEST_F(LibHidlTest, StatusStringTest) {
 
 }
 
+TEST_F(LibHidlTest, StatusParcelTest) {
+    using ::android::hardware::Parcel;
+    using ::android::hardware::Status;
+
+    auto roundTrip = [](const Status &status) {
+        Parcel parcel;
+        EXPECT_EQ(::android::OK, writeToParcel(status, &parcel));
+        parcel.setDataPosition(0);
+        Status read;
+        EXPECT_EQ(::android::OK, readFromParcel(&read, parcel));
+        return read;
+    };
+
+    EXPECT_TRUE(roundTrip(Status::ok()).isOk());
+
+    const std::string longMessage(1000, 'x');
+    for (const std::string message : {"", "Permission denied", "caf\xc3\xa9 \xf0\x9f\x98\x80",
+                                       longMessage.c_str()}) {
+        Status read = roundTrip(Status::fromExceptionCode(Status::EX_SECURITY, message.c_str()));
+        EXPECT_EQ(Status::EX_SECURITY, read.exceptionCode());
+        EXPECT_EQ(message, read.exceptionMessage());
+    }
+}
+
+TEST_F(LibHidlTest, ParcelBufferIndexTest) {
+    using ::android::hardware::Parcel;
+    using ::android::hardware::details::ParcelBufferIndex;
+
+    struct Node {
+        const Node* next;
+        uint64_t value;
+    };
+    Node nodes[4] = {};
+
+    // All of nodes, then nodes[1] again nested inside it, and nodes[2] on its
+    // own, as generated code writes a vector and then pointers into it.
+    Parcel parcel;
+    ParcelBufferIndex index(&parcel);
+    size_t handle;
+    size_t nestedHandle;
+    ASSERT_EQ(::android::OK, parcel.writeBuffer(nodes, sizeof(nodes), &handle));
+    ASSERT_EQ(::android::OK, parcel.writeEmbeddedBuffer(&nodes[1], sizeof(Node), &nestedHandle,
+                                                        handle, offsetof(Node, next)));
+
+    // Each lookup finds what findBuffer does, which is the first buffer written
+    // that contains the pointer, also as buffers are added between lookups.
+    auto check = [&](const void* ptr, size_t length) {
+        bool expectedFound;
+        size_t expectedHandle = 0;
+        size_t expectedOffset = 0;
+        ::android::status_t expectedStatus = parcel.findBuffer(
+                ptr, length, &expectedFound, &expectedHandle, &expectedOffset);
+
+        bool found;
+        size_t foundHandle = 0;
+        size_t offset = 0;
+        ::android::status_t status = index.findBuffer(&parcel, ptr, length, &found,
+                                                      &foundHandle, &offset);
+        EXPECT_EQ(expectedStatus, status);
+        if (status != ::android::OK) {
+            return;
+        }
+        EXPECT_EQ(expectedFound, found);
+        if (found && expectedFound) {
+            EXPECT_EQ(expectedHandle, foundHandle);
+            EXPECT_EQ(expectedOffset, offset);
+        }
+    };
+    for (const Node& node : nodes) {
+        check(&node, sizeof(Node));
+        check(&node.value, sizeof(uint64_t));
+    }
+    check(&nodes[3] + 1, sizeof(Node));
+    check(&nodes[3], 2 * sizeof(Node));
+
+    // Starting in a buffer but running past its end is an error, rather than
+    // a pointer to write in a buffer of its own.
+    bool overflowFound = true;
+    size_t overflowHandle;
+    size_t overflowOffset;
+    EXPECT_EQ(::android::BAD_VALUE, index.findBuffer(&parcel, &nodes[3], 2 * sizeof(Node),
+                                                     &overflowFound, &overflowHandle,
+                                                     &overflowOffset));
+    EXPECT_FALSE(overflowFound);
+
+    Node other;
+    check(&other, sizeof(Node));
+    ASSERT_EQ(::android::OK, parcel.writeEmbeddedBuffer(&other, sizeof(Node), &handle,
+                                                        nestedHandle, offsetof(Node, next)));
+    check(&other, sizeof(Node));
+    check(&nodes[1], sizeof(Node));
+
+    // An index only answers for its own Parcel.
+    Parcel otherParcel;
+    bool found;
+    size_t offset;
+    EXPECT_EQ(::android::BAD_VALUE, index.findBuffer(&otherParcel, &nodes[0], sizeof(Node),
+                                                     &found, &handle, &offset));
+}
+
+TEST_F(LibHidlTest, LoopbackParcelTest) {
+    using ::android::hardware::Parcel;
+    using ::android::hardware::hidl_string;
+    using ::android::hardware::hidl_vec;
+    using ::android::hardware::details::deliverParcel;
+
+    hidl_vec<hidl_string> names = {"android.hardware.foo@1.0::IFoo", "", "default"};
+
+    Parcel parcel;
+    size_t handle;
+    size_t vecHandle;
+    ASSERT_EQ(::android::OK, parcel.writeBuffer(&names, sizeof(names), &handle));
+    ASSERT_EQ(::android::OK, writeEmbeddedToParcel(names, &parcel, handle, 0, &vecHandle));
+    for (size_t i = 0; i < names.size(); i++) {
+        ASSERT_EQ(::android::OK,
+                  writeEmbeddedToParcel(names[i], &parcel, vecHandle, i * sizeof(hidl_string)));
+    }
+
+    Parcel delivered;
+    ASSERT_EQ(::android::OK, deliverParcel(parcel, &delivered));
+
+    const void* out;
+    ASSERT_EQ(::android::OK, delivered.readBuffer(sizeof(names), &handle, &out));
+    const hidl_vec<hidl_string>& read = *static_cast<const hidl_vec<hidl_string>*>(out);
+    ASSERT_EQ(::android::OK, readEmbeddedFromParcel(read, delivered, handle, 0, &vecHandle));
+    for (size_t i = 0; i < read.size(); i++) {
+        ASSERT_EQ(::android::OK,
+                  readEmbeddedFromParcel(read[i], delivered, vecHandle, i * sizeof(hidl_string)));
+    }
+
+    // Same contents, in copies rather than in the sender's memory.
+    EXPECT_EQ(names, read);
+    EXPECT_NE(names.data(), read.data());
+    EXPECT_NE(names[0].c_str(), read[0].c_str());
+}
+
+TEST_F(LibHidlTest, LoopbackStubTest) {
+    using ::android::sp;
+    using ::android::hardware::BHwBinder;
+    using ::android::hardware::IBinder;
+    using ::android::hardware::Parcel;
+    using ::android::hardware::hidl_memory;
+    using ::android::hardware::hidl_string;
+    using ::android::hardware::hidl_vec;
+    using ::android::hardware::details::LoopbackBinder;
+    using ::android::hardware::details::setLoopbackTransportEnabled;
+
+    // Replies with a string. Through the callback, the string is on the stub's
+    // stack and is overwritten once the callback returns; otherwise it is the
+    // stub's own and the reply is returned without calling the callback.
+    struct ReplyBinder : public BHwBinder {
+        explicit ReplyBinder(bool useCallback) : mUseCallback(useCallback) {}
+
+        ::android::status_t onTransact(uint32_t /* code */, const Parcel& /* data */,
+                                       Parcel* reply, uint32_t /* flags */,
+                                       TransactCallback callback) override {
+            char buffer[] = "from the stack";
+            hidl_string stackString;
+            stackString.setToExternal(buffer, strlen(buffer));
+            const hidl_string& str = mUseCallback ? stackString : mString;
+
+            size_t handle;
+            ::android::status_t status = reply->writeBuffer(&str, sizeof(str), &handle);
+            if (status != ::android::OK) return status;
+            status = writeEmbeddedToParcel(str, reply, handle, 0);
+            if (status != ::android::OK) return status;
+            if (mUseCallback) {
+                callback(*reply);
+                memset(buffer, 'x', strlen(buffer));
+            }
+            return ::android::OK;
+        }
+
+        const bool mUseCallback;
+        const hidl_string mString = "from the stub";
+    };
+
+    auto readString = [](const Parcel& reply, std::string* out) {
+        size_t handle;
+        const void* buffer;
+        ASSERT_EQ(::android::OK, reply.readBuffer(sizeof(hidl_string), &handle, &buffer));
+        const hidl_string& str = *static_cast<const hidl_string*>(buffer);
+        ASSERT_EQ(::android::OK, readEmbeddedFromParcel(str, reply, handle, 0));
+        *out = str;
+    };
+
+    for (bool useCallback : {true, false}) {
+        const std::string expected = useCallback ? "from the stack" : "from the stub";
+        sp<IBinder> stub = new ReplyBinder(useCallback);
+        sp<IBinder> loopback = new LoopbackBinder(stub);
+        EXPECT_EQ(stub, LoopbackBinder::unwrap(loopback));
+
+        Parcel data;
+        Parcel reply;
+        std::string inCallback;
+        ASSERT_EQ(::android::OK, loopback->transact(0, data, &reply, 0, [&](Parcel& r) {
+            readString(r, &inCallback);
+        }));
+        EXPECT_EQ(expected, inCallback);
+
+        // Also without a callback, the reply is left in reply.
+        Parcel noCallbackReply;
+        ASSERT_EQ(::android::OK, loopback->transact(0, data, &noCallbackReply));
+        std::string read;
+        readString(noCallbackReply, &read);
+        EXPECT_EQ(expected, read);
+    }
+
+    // A generated proxy and stub, through fromBinder.
+    using ::android::hidl::allocator::V1_0::BnHwAllocator;
+    using ::android::hidl::allocator::V1_0::BpHwAllocator;
+    using ::android::hidl::allocator::V1_0::IAllocator;
+    using ::android::hidl::allocator::V1_0::implementation::AshmemAllocator;
+
+    sp<IAllocator> impl = new AshmemAllocator();
+    sp<IBinder> binder = ::android::hardware::toBinder<IAllocator>(impl);
+    ASSERT_NE(nullptr, binder.get());
+
+    setLoopbackTransportEnabled(true);
+    sp<IAllocator> proxy =
+            ::android::hardware::fromBinder<IAllocator, BpHwAllocator, BnHwAllocator>(binder);
+    setLoopbackTransportEnabled(false);
+    ASSERT_NE(nullptr, proxy.get());
+    EXPECT_TRUE(proxy->isRemote());
+    EXPECT_NE(impl.get(), proxy.get());
+    // Passed back to this process, the proxy is sent as its stub.
+    EXPECT_EQ(binder, ::android::hardware::toBinder<IAllocator>(proxy));
+
+    EXPECT_TRUE(proxy->ping().isOk());
+    hidl_string descriptor;
+    EXPECT_TRUE(proxy->interfaceDescriptor([&](const hidl_string& d) {
+        descriptor = d;
+    }).isOk());
+    EXPECT_EQ(std::string(::android::hidl::allocator::V1_1::IAllocator::descriptor),
+              std::string(descriptor.c_str()));
+    hidl_vec<hidl_string> chain;
+    EXPECT_TRUE(proxy->interfaceChain([&](const hidl_vec<hidl_string>& c) {
+        chain = c;
+    }).isOk());
+    ASSERT_EQ(3u, chain.size());
+    EXPECT_EQ(std::string(IAllocator::descriptor), std::string(chain[1].c_str()));
+
+    bool allocated = false;
+    EXPECT_TRUE(proxy->allocate(4096, [&](bool success, const hidl_memory& mem) {
+        allocated = success;
+        EXPECT_EQ(4096u, mem.size());
+        EXPECT_EQ("ashmem", std::string(mem.name()));
+    }).isOk());
+    EXPECT_TRUE(allocated);
+
+    // Without loopback, a local binder gives back the implementation.
+    EXPECT_EQ(impl.get(),
+              (::android::hardware::fromBinder<IAllocator, BpHwAllocator, BnHwAllocator>(binder))
+                      .get());
+}
+
+// Reads a T from the top of data, and writes it to reply.
+template <typename T>
+static ::android::status_t echoParcel(const ::android::hardware::Parcel& data,
+                                      ::android::hardware::Parcel* reply) {
+    size_t handle;
+    const void* in;
+    ::android::status_t status = data.readBuffer(sizeof(T), &handle, &in);
+    if (status != ::android::OK) return status;
+    const T& value = *static_cast<const T*>(in);
+    status = readEmbeddedFromParcel(value, data, handle, 0);
+    if (status != ::android::OK) return status;
+    status = reply->writeBuffer(&value, sizeof(value), &handle);
+    if (status != ::android::OK) return status;
+    return writeEmbeddedToParcel(value, reply, handle, 0);
+}
+
+TEST_F(LibHidlTest, SocketTransportTest) {
+    using ::android::sp;
+    using ::android::hardware::BHwBinder;
+    using ::android::hardware::IBinder;
+    using ::android::hardware::Parcel;
+    using ::android::hardware::hidl_memory;
+    using ::android::hardware::hidl_string;
+    using ::android::hardware::details::SocketServer;
+    using ::android::hardware::details::connectToSocket;
+    using ::android::hardware::details::serveOnSocket;
+
+    // Replies with the string, or for code 1 the memory, it is sent.
+    struct EchoBinder : public BHwBinder {
+        ::android::status_t onTransact(uint32_t code, const Parcel& data, Parcel* reply,
+                                       uint32_t /* flags */, TransactCallback callback) override {
+            ::android::status_t status = code == 1 ? echoParcel<hidl_memory>(data, reply)
+                                                   : echoParcel<hidl_string>(data, reply);
+            if (status != ::android::OK) return status;
+            callback(*reply);
+            return ::android::OK;
+        }
+    };
+
+    const std::string path = "@libhidl_test_" + std::to_string(getpid());
+    std::unique_ptr<SocketServer> server = serveOnSocket(path, new EchoBinder());
+    ASSERT_NE(nullptr, server.get());
+    sp<IBinder> remote = connectToSocket(path);
+    ASSERT_NE(nullptr, remote.get());
+
+    // The long string doesn't fit in one message and is sent in a memfd.
+    for (const hidl_string sent : {hidl_string(""), hidl_string("default"),
+                                   hidl_string(std::string(1 << 20, 'x'))}) {
+        Parcel data;
+        size_t handle;
+        ASSERT_EQ(::android::OK, data.writeBuffer(&sent, sizeof(sent), &handle));
+        ASSERT_EQ(::android::OK, writeEmbeddedToParcel(sent, &data, handle, 0));
+
+        bool called = false;
+        Parcel reply;
+        EXPECT_EQ(::android::OK, remote->transact(0, data, &reply, 0, [&](Parcel& received) {
+            const void* out;
+            ASSERT_EQ(::android::OK, received.readBuffer(sizeof(hidl_string), &handle, &out));
+            const hidl_string& read = *static_cast<const hidl_string*>(out);
+            ASSERT_EQ(::android::OK, readEmbeddedFromParcel(read, received, handle, 0));
+            EXPECT_EQ(sent, read);
+            called = true;
+        }));
+        EXPECT_TRUE(called);
+    }
+
+    // A file descriptor, there and back again.
+    int fd = syscall(__NR_memfd_create, "SocketTransportTest", MFD_CLOEXEC);
+    if (fd < 0) {
+        LOG(INFO) << "memfd_create is not supported, skipping the file descriptor test.";
+    } else {
+        const char contents[] = "from the client";
+        ASSERT_EQ(static_cast<ssize_t>(sizeof(contents)), write(fd, contents, sizeof(contents)));
+        native_handle_t* handle = native_handle_create(1 /* numFds */, 0 /* numInts */);
+        handle->data[0] = fd;
+        const hidl_memory sent("memfd", handle, sizeof(contents));
+
+        Parcel data;
+        size_t parentHandle;
+        ASSERT_EQ(::android::OK, data.writeBuffer(&sent, sizeof(sent), &parentHandle));
+        ASSERT_EQ(::android::OK, writeEmbeddedToParcel(sent, &data, parentHandle, 0));
+
+        bool called = false;
+        EXPECT_EQ(::android::OK, remote->transact(1, data, nullptr, 0, [&](Parcel& received) {
+            const void* out;
+            ASSERT_EQ(::android::OK,
+                      received.readBuffer(sizeof(hidl_memory), &parentHandle, &out));
+            const hidl_memory& read = *static_cast<const hidl_memory*>(out);
+            ASSERT_EQ(::android::OK, readEmbeddedFromParcel(read, received, parentHandle, 0));
+            ASSERT_NE(nullptr, read.handle());
+            ASSERT_EQ(1, read.handle()->numFds);
+            EXPECT_NE(fd, read.handle()->data[0]);
+            char buffer[sizeof(contents)] = {};
+            EXPECT_EQ(static_cast<ssize_t>(sizeof(buffer)),
+                      pread(read.handle()->data[0], buffer, sizeof(buffer), 0));
+            EXPECT_STREQ(contents, buffer);
+            called = true;
+        }));
+        EXPECT_TRUE(called);
+        native_handle_close(handle);
+        native_handle_delete(handle);
+    }
+
+    // Once the server is shut down, its connections are closed, and so is the socket.
+    server->shutdown();
+    Parcel empty;
+    EXPECT_EQ(::android::DEAD_OBJECT, remote->transact(0, empty, nullptr));
+    EXPECT_EQ(nullptr, connectToSocket(path).get());
+
+    // Clients running as other uids are turned away.
+    server = serveOnSocket(path, new EchoBinder(), {getuid() + 1});
+    ASSERT_NE(nullptr, server.get());
+    sp<IBinder> refused = connectToSocket(path);
+    ASSERT_NE(nullptr, refused.get());
+    EXPECT_EQ(::android::DEAD_OBJECT, refused->transact(0, empty, nullptr));
+    server.reset();
+}
+
+TEST_F(LibHidlTest, SocketStubTest) {
+    using ::android::sp;
+    using ::android::hardware::hidl_memory;
+    using ::android::hardware::details::SocketServer;
+    using ::android::hardware::details::connectToSocket;
+    using ::android::hardware::details::serveOnSocket;
+    using ::android::hidl::allocator::V1_0::BnHwAllocator;
+    using ::android::hidl::allocator::V1_0::BpHwAllocator;
+    using ::android::hidl::allocator::V1_0::IAllocator;
+    using ::android::hidl::allocator::V1_0::implementation::AshmemAllocator;
+
+    const std::string path = "@libhidl_test_stub_" + std::to_string(getpid());
+    sp<IAllocator> impl = new AshmemAllocator();
+    std::unique_ptr<SocketServer> server =
+            serveOnSocket(path, ::android::hardware::toBinder<IAllocator>(impl));
+    ASSERT_NE(nullptr, server.get());
+
+    sp<IAllocator> proxy =
+            ::android::hardware::fromBinder<IAllocator, BpHwAllocator, BnHwAllocator>(
+                    connectToSocket(path));
+    ASSERT_NE(nullptr, proxy.get());
+    EXPECT_TRUE(proxy->isRemote());
+    EXPECT_TRUE(proxy->ping().isOk());
+
+    // The memory's file descriptor comes over the socket; it is the client's
+    // own until the reply is freed, so it can be mapped in the callback.
+    bool allocated = false;
+    EXPECT_TRUE(proxy->allocate(4096, [&](bool success, const hidl_memory& mem) {
+        allocated = success;
+        ASSERT_TRUE(success);
+        ASSERT_EQ(1, mem.handle()->numFds);
+        void* data = mmap(nullptr, 4096, PROT_READ | PROT_WRITE, MAP_SHARED,
+                          mem.handle()->data[0], 0);
+        ASSERT_NE(MAP_FAILED, data);
+        memset(data, 'x', 4096);
+        EXPECT_EQ('x', static_cast<char*>(data)[4095]);
+        munmap(data, 4096);
+    }).isOk());
+    EXPECT_TRUE(allocated);
+
+    server->shutdown();
+    EXPECT_FALSE(proxy->ping().isOk());
+}
+
+TEST_F(LibHidlTest, PassthroughLibraryNameTest) {
+    using android::hardware::details::matchPassthroughLibraryName;
+    static const std::regex pattern(
+        "([a-zA-Z_][a-zA-Z_0-9]*(?:[.][a-zA-Z_][a-zA-Z_0-9]*)*@[0-9]+[.][0-9]+)-impl(.*?).so");
+
+    auto check = [&](const std::string &name) {
+        std::smatch match;
+        bool expected = std::regex_match(name, match, pattern);
+        size_t fqPackageLength;
+        const char* suffix;
+        size_t suffixLength;
+        bool actual = matchPassthroughLibraryName(name.c_str(), name.size(), &fqPackageLength,
+                                                  &suffix, &suffixLength);
+        EXPECT_EQ(expected, actual) << name;
+        if (expected && actual) {
+            EXPECT_EQ(match.str(1), name.substr(0, fqPackageLength)) << name;
+            EXPECT_EQ(match.str(2), std::string(suffix, suffixLength)) << name;
+        }
+    };
+
+    check("android.hardware.foo@1.0-impl.so");
+    check("android.hardware.foo@1.0-impl-qti.so");
+    check("android.hardware.foo@12.34-implXso");
+    check("android.hardware.foo@1.0-impl.s");
+    check("android.hardware.foo@1.0-service.so");
+    check("android.hardware.2foo@1.0-impl.so");
+    check("android..foo@1.0-impl.so");
+    check("android.hardware.foo@1-impl.so");
+    check("android.hardware.foo@1.0-impl\n.so");
+    check("");
+
+    // Differential test against the regex on random names.
+    const char* fragments[] = {"a", "Z", "_", "0", "9", ".", "@", "-", "-impl", "so", ".so",
+                               "\n", "1.0", "@1.0", "android.hardware.foo"};
+    std::mt19937 rng(42);
+    for (int i = 0; i < 20000; i++) {
+        std::string name;
+        for (int j = rng() % 8; j > 0; j--) {
+            name += fragments[rng() % (sizeof(fragments) / sizeof(fragments[0]))];
+        }
+        check(name);
+    }
+}
+
+TEST_F(LibHidlTest, InstrumentationLibNameTest) {
+    using android::hardware::details::matchInstrumentationLibName;
+
+    auto check = [&](const std::string &name, const std::string &package) {
+        std::regex pattern("^" + package + "(.*).profiler.so$");
+        std::cmatch match;
+        EXPECT_EQ(std::regex_match(name.c_str(), match, pattern),
+                  matchInstrumentationLibName(name.c_str(), name.size(), package.c_str(),
+                                              package.size())) << name << " " << package;
+    };
+
+    const std::string package = "android.hardware.foo@1.0";
+    check("android.hardware.foo@1.0.profiler.so", package);
+    check("android.hardware.foo@1.0-IFoo-vts.profiler.so", package);
+    check("android_hardware_foo@1_0-vts.profiler.so", package);
+    check("android.hardware.foo@1.0.profiler.s", package);
+    check("android.hardware.bar@1.0.profiler.so", package);
+    check("android.hardware.foo@1.0-vts.profilerXso", package);
+    check(".profiler.so", "");
+    check("profiler.so", "");
+
+    const char* fragments[] = {"android.hardware.foo@1.0", "android", ".", "_", "@", "profiler",
+                               ".profiler.so", "so", "x", "\r"};
+    std::mt19937 rng(42);
+    for (int i = 0; i < 5000; i++) {
+        std::string name;
+        for (int j = rng() % 6; j > 0; j--) {
+            name += fragments[rng() % (sizeof(fragments) / sizeof(fragments[0]))];
+        }
+        check(name, package);
+    }
+}
+
+TEST_F(LibHidlTest, WellFormedStringTest) {
+    using android::hardware::details::isWellFormedString;
+
+    auto check = [&](const std::string &s) { return isWellFormedString(s.data(), s.size()); };
+
+    EXPECT_TRUE(check(""));
+    EXPECT_TRUE(check("android.hardware.foo@1.0::IFoo/default"));
+    EXPECT_TRUE(check("caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80 \xf4\x8f\xbf\xbf"));
+    EXPECT_FALSE(check(std::string("abc\0def", 7)));
+    EXPECT_FALSE(check(std::string(40, 'a') + '\0' + std::string(40, 'a')));  // word-at-a-time path
+    EXPECT_FALSE(check("\x80"));              // stray continuation byte
+    EXPECT_FALSE(check("\xc0\xaf"));          // overlong '/'
+    EXPECT_FALSE(check("\xe0\x80\xaf"));      // overlong '/'
+    EXPECT_FALSE(check("\xed\xa0\x80"));      // surrogate
+    EXPECT_FALSE(check("\xf4\x90\x80\x80"));  // > U+10FFFF
+    EXPECT_FALSE(check("\xe2\x82"));          // truncated
+    EXPECT_FALSE(check("\xff"));
+}
+
+TEST_F(LibHidlTest, MemfdMemoryTest) {
+    using android::sp;
+    using android::hardware::hidl_memory;
+    using android::hidl::allocator::V1_0::implementation::MemfdAllocator;
+    using android::hidl::memory::V1_0::IMemory;
+    using android::hidl::memory::V1_0::implementation::MemfdMapper;
+
+    if (!MemfdAllocator::isSupported()) {
+        LOG(INFO) << "memfd_create is not supported, skipping.";
+        return;
+    }
+
+    sp<MemfdAllocator> allocator = new MemfdAllocator();
+    sp<MemfdMapper> mapper = new MemfdMapper();
+    sp<IMemory> memory;
+    sp<IMemory> range;
+
+    allocator->allocate(8192, [&](bool success, const hidl_memory& mem) {
+        ASSERT_TRUE(success);
+        EXPECT_EQ("memfd", std::string(mem.name()));
+        EXPECT_EQ(8192u, mem.size());
+
+        // The size is sealed.
+        int fd = mem.handle()->data[0];
+        EXPECT_NE(0, ftruncate(fd, 0));
+        EXPECT_NE(0, ftruncate(fd, 16384));
+
+        memory = mapper->mapMemory(mem);
+        ASSERT_NE(nullptr, memory.get());
+        char* data = static_cast<char*>(static_cast<void*>(memory->getPointer()));
+        memset(data, 0, 8192);
+        strcpy(data + 5000, "hidl");
+
+        range = mapper->mapMemoryRange(mem, 5000, 5, true /* readOnly */);
+        EXPECT_EQ(nullptr, mapper->mapMemoryRange(mem, 8000, 500, true /* readOnly */).get());
+    });
+
+    ASSERT_NE(nullptr, range.get());
+    EXPECT_EQ(5u, static_cast<uint64_t>(range->getSize()));
+    EXPECT_STREQ("hidl", static_cast<const char*>(static_cast<void*>(range->getPointer())));
+
+    // Unsealed memfds could shrink under the mapping, so they aren't mapped.
+    int fd = syscall(__NR_memfd_create, "MemfdMemoryTest", MFD_CLOEXEC);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(0, ftruncate(fd, 4096));
+    native_handle_t* handle = native_handle_create(1, 0);
+    handle->data[0] = fd;
+    EXPECT_EQ(nullptr, mapper->mapMemory(hidl_memory("memfd", handle, 4096)).get());
+    native_handle_close(handle);
+    native_handle_delete(handle);
+}
+
+// Checks that allocator fills batches of regions of 4096 bytes.
+static void checkBatchAllocate(
+        const android::sp<android::hidl::allocator::V1_1::IAllocator>& allocator) {
+    using android::hardware::hidl_memory;
+    using android::hardware::hidl_vec;
+
+    allocator->batchAllocate(4096, 100, [&](bool success, const hidl_vec<hidl_memory>& batch) {
+        EXPECT_TRUE(success);
+        ASSERT_EQ(100u, batch.size());
+        for (const hidl_memory& mem : batch) {
+            EXPECT_NE(nullptr, mem.handle());
+            EXPECT_EQ(4096u, mem.size());
+        }
+    });
+
+    allocator->batchAllocatePartial(4096, 100,
+            [&](const hidl_vec<bool>& success, const hidl_vec<hidl_memory>& batch) {
+        ASSERT_EQ(100u, success.size());
+        ASSERT_EQ(100u, batch.size());
+        for (size_t i = 0; i < batch.size(); i++) {
+            EXPECT_TRUE(success[i]);
+            EXPECT_NE(nullptr, batch[i].handle());
+        }
+    });
+
+    // Small batches are allocated on the calling thread only.
+    allocator->batchAllocatePartial(4096, 1,
+            [&](const hidl_vec<bool>& success, const hidl_vec<hidl_memory>& batch) {
+        ASSERT_EQ(1u, success.size());
+        EXPECT_TRUE(success[0]);
+        EXPECT_NE(nullptr, batch[0].handle());
+    });
+    allocator->batchAllocate(4096, 0, [&](bool success, const hidl_vec<hidl_memory>& batch) {
+        EXPECT_TRUE(success);
+        EXPECT_EQ(0u, batch.size());
+    });
+}
+
+TEST_F(LibHidlTest, MemfdBatchAllocateTest) {
+    using android::sp;
+    using android::hardware::hidl_memory;
+    using android::hardware::hidl_vec;
+    using android::hidl::allocator::V1_0::implementation::MemfdAllocator;
+
+    if (!MemfdAllocator::isSupported()) {
+        LOG(INFO) << "memfd_create is not supported, skipping.";
+        return;
+    }
+
+    sp<MemfdAllocator> allocator = new MemfdAllocator();
+    checkBatchAllocate(allocator);
+
+    // Every element fails, but the batch is still returned element by element.
+    allocator->batchAllocatePartial(0, 3,
+            [&](const hidl_vec<bool>& success, const hidl_vec<hidl_memory>& batch) {
+        ASSERT_EQ(3u, success.size());
+        ASSERT_EQ(3u, batch.size());
+        for (size_t i = 0; i < batch.size(); i++) {
+            EXPECT_FALSE(success[i]);
+            EXPECT_EQ(nullptr, batch[i].handle());
+        }
+    });
+    allocator->batchAllocate(0, 3, [&](bool success, const hidl_vec<hidl_memory>& batch) {
+        EXPECT_FALSE(success);
+        EXPECT_EQ(0u, batch.size());
+    });
+}
+
+TEST_F(LibHidlTest, AshmemBatchAllocateTest) {
+    using android::sp;
+    using android::hardware::hidl_memory;
+    using android::hidl::allocator::V1_0::implementation::AshmemAllocator;
+
+    sp<AshmemAllocator> allocator = new AshmemAllocator();
+    checkBatchAllocate(allocator);
+
+    allocator->allocate(4096, [&](bool success, const hidl_memory& mem) {
+        ASSERT_TRUE(success);
+        EXPECT_EQ("ashmem", std::string(mem.name()));
+        EXPECT_EQ(4096u, mem.size());
+        EXPECT_NE(nullptr, mem.handle());
+    });
+}
+
+TEST_F(LibHidlTest, MappingCacheTest) {
+    using android::sp;
+    using android::hardware::hidl_memory;
+    using android::hardware::mapMemory;
+    using android::hardware::setMappingCacheCapacity;
+    using android::hidl::memory::V1_0::IMemory;
+
+    setMappingCacheCapacity(8);
+
+    // Every ashmem fd refers to the same device inode, so regions with the same
+    // name and size must still be mapped separately.
+    native_handle_t* handles[2];
+    sp<IMemory> mapped[2];
+    for (size_t i = 0; i < 2; i++) {
+        int fd = ashmem_create_region("MappingCacheTest", 4096);
+        ASSERT_GE(fd, 0);
+        void* data = mmap(nullptr, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ASSERT_NE(MAP_FAILED, data);
+        memset(data, 'a' + i, 4096);
+        munmap(data, 4096);
+
+        handles[i] = native_handle_create(1, 0);
+        handles[i]->data[0] = fd;
+        mapped[i] = mapMemory(hidl_memory("ashmem", handles[i], 4096));
+        ASSERT_NE(nullptr, mapped[i].get());
+    }
+
+    EXPECT_NE(mapped[0].get(), mapped[1].get());
+    EXPECT_EQ('a', static_cast<char*>(static_cast<void*>(mapped[0]->getPointer()))[0]);
+    EXPECT_EQ('b', static_cast<char*>(static_cast<void*>(mapped[1]->getPointer()))[0]);
+
+    setMappingCacheCapacity(0);
+    for (native_handle_t* handle : handles) {
+        native_handle_close(handle);
+        native_handle_delete(handle);
+    }
+}
+
+namespace android {
+namespace hidl {
+namespace allocator {
+namespace V1_0 {
+namespace implementation {
+
+// Pools with a period of 10ms, whose regions are fds of /dev/null.
+class RegionPoolTest : public ::testing::Test {
+public:
+    void SetUp() override {
+        const RegionPool::Config config{4 /* maxRegionsPerSize */, 1 << 20 /* maxBytes */,
+                                        4 /* maxSizes */, std::chrono::milliseconds(10)};
+        pool.reset(new RegionPool(config, [this](uint64_t /* size */) {
+            created++;
+            return open("/dev/null", O_RDONLY | O_CLOEXEC);
+        }));
+    }
+
+    size_t wakeups() {
+        std::unique_lock<std::mutex> lock(pool->mMutex);
+        return pool->mWakeups;
+    }
+
+    size_t sizes() {
+        std::unique_lock<std::mutex> lock(pool->mMutex);
+        return pool->mSizes.size();
+    }
+
+    std::atomic<size_t> created{0};
+    std::unique_ptr<RegionPool> pool;
+};
+
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace allocator
+}  // namespace hidl
+}  // namespace android
+
+using android::hidl::allocator::V1_0::implementation::RegionPoolTest;
+
+TEST_F(RegionPoolTest, IdleTest) {
+    // Nothing was ever asked for, so the thread has no reason to wake up.
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_EQ(0u, wakeups());
+
+    // One request keeps a region ready, until the target decays and the size
+    // is forgotten.
+    int fd = pool->take(4096);
+    if (fd >= 0) {
+        close(fd);
+    }
+    for (int i = 0; i < 200 && sizes() > 0; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_EQ(0u, sizes());
+    EXPECT_GE(created.load(), 1u);
+
+    // Idle again, the pool sleeps through many periods.
+    const size_t idleWakeups = wakeups();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_EQ(idleWakeups, wakeups());
+
+    // A new request wakes it up again.
+    fd = pool->take(8192);
+    if (fd >= 0) {
+        close(fd);
+    }
+    for (int i = 0; i < 200 && created.load() < 2; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_GE(created.load(), 2u);
+}
+
+namespace android {
+namespace hardware {
+
+// Heaps of 4096 bytes, so blocks have orders 0 (64 bytes) to 6 (the whole heap).
+class MemoryHeapTest : public ::testing::Test {
+public:
+    void SetUp() override {
+        using android::hidl::allocator::V1_0::implementation::MemfdAllocator;
+
+        if (!MemfdAllocator::isSupported()) {
+            LOG(INFO) << "memfd_create is not supported, skipping.";
+            return;
+        }
+        heap = MemoryHeap::create(new MemfdAllocator(), 4096);
+        ASSERT_NE(nullptr, heap.get());
+        ASSERT_EQ(4096u, heap->size());
+    }
+
+    // Frees a block that isn't (necessarily) owned by a MemoryBlock.
+    bool release(uint64_t offset, size_t order) { return heap->free(offset, order); }
+
+    sp<MemoryHeap> heap;
+};
+
+}  // namespace hardware
+}  // namespace android
+
+using android::hardware::MemoryBlock;
+using android::hardware::MemoryHeapTest;
+
+TEST_F(MemoryHeapTest, SplitTest) {
+    if (heap == nullptr) {
+        return;
+    }
+
+    // Each allocation takes the lowest free block of the smallest order that
+    // fits, and splitting the heap for the first one leaves one free block of
+    // every lower order.
+    android::sp<MemoryBlock> a = heap->allocate(64);
+    android::sp<MemoryBlock> b = heap->allocate(1);
+    android::sp<MemoryBlock> c = heap->allocate(100);
+    android::sp<MemoryBlock> d = heap->allocate(1000);
+    ASSERT_NE(nullptr, a.get());
+    ASSERT_NE(nullptr, b.get());
+    ASSERT_NE(nullptr, c.get());
+    ASSERT_NE(nullptr, d.get());
+    EXPECT_EQ(0u, a->offset());
+    EXPECT_EQ(64u, b->offset());
+    EXPECT_EQ(128u, c->offset());
+    EXPECT_EQ(1024u, d->offset());
+    EXPECT_EQ(1u, b->size());
+    EXPECT_EQ(100u, c->size());
+    EXPECT_EQ(4096u - 64 - 64 - 128 - 1024, heap->available());
+}
+
+TEST_F(MemoryHeapTest, CoalesceTest) {
+    if (heap == nullptr) {
+        return;
+    }
+
+    std::vector<android::sp<MemoryBlock>> blocks;
+    for (uint64_t size : {64, 64, 128, 256, 512, 1024, 2048}) {
+        blocks.push_back(heap->allocate(size));
+        ASSERT_NE(nullptr, blocks.back().get());
+    }
+    EXPECT_EQ(0u, heap->available());
+    EXPECT_EQ(nullptr, heap->allocate(64).get());
+
+    // Freeing in an order where buddies are mostly not free yet still merges
+    // everything back into the whole heap.
+    for (size_t i : {1, 3, 5, 0, 2, 6, 4}) {
+        blocks[i].clear();
+    }
+    EXPECT_EQ(4096u, heap->available());
+    android::sp<MemoryBlock> whole = heap->allocate(4096);
+    ASSERT_NE(nullptr, whole.get());
+    EXPECT_EQ(0u, whole->offset());
+}
+
+TEST_F(MemoryHeapTest, ExhaustionTest) {
+    if (heap == nullptr) {
+        return;
+    }
+
+    std::vector<android::sp<MemoryBlock>> blocks;
+    for (size_t i = 0; i < 64; i++) {
+        blocks.push_back(heap->allocate(64));
+        ASSERT_NE(nullptr, blocks.back().get());
+    }
+    EXPECT_EQ(0u, heap->available());
+    EXPECT_EQ(nullptr, heap->allocate(1).get());
+
+    EXPECT_EQ(nullptr, heap->allocate(0).get());
+    EXPECT_EQ(nullptr, heap->allocate(4097).get());
+
+    // Free space that is fragmented doesn't fit a larger block.
+    uint64_t offset = blocks[10]->offset();
+    blocks[10].clear();
+    blocks[13].clear();
+    EXPECT_EQ(128u, heap->available());
+    EXPECT_EQ(nullptr, heap->allocate(128).get());
+    android::sp<MemoryBlock> block = heap->allocate(64);
+    ASSERT_NE(nullptr, block.get());
+    EXPECT_EQ(offset, block->offset());
+}
+
+TEST_F(MemoryHeapTest, AlignmentTest) {
+    if (heap == nullptr) {
+        return;
+    }
+
+    std::vector<android::sp<MemoryBlock>> blocks;
+    for (uint64_t size : {1, 65, 200, 64, 700, 129, 3, 1000}) {
+        android::sp<MemoryBlock> block = heap->allocate(size);
+        ASSERT_NE(nullptr, block.get());
+
+        // Blocks are aligned to their size rounded up to a power of two.
+        uint64_t rounded = android::hardware::MemoryHeap::kMinBlockSize;
+        while (rounded < size) {
+            rounded <<= 1;
+        }
+        EXPECT_EQ(0u, block->offset() % rounded) << "size " << size;
+        EXPECT_LE(block->offset() + rounded, heap->size());
+        EXPECT_EQ(static_cast<uint8_t*>(heap->pointer()) + block->offset(), block->pointer());
+
+        // Blocks don't overlap.
+        memset(block->pointer(), static_cast<int>(blocks.size()), size);
+        blocks.push_back(block);
+    }
+    for (size_t i = 0; i < blocks.size(); i++) {
+        EXPECT_EQ(static_cast<uint8_t>(i), *static_cast<uint8_t*>(blocks[i]->pointer()));
+        EXPECT_EQ(heap->memory().handle(), blocks[i]->memory().handle());
+    }
+}
+
+TEST_F(MemoryHeapTest, DoubleFreeTest) {
+    if (heap == nullptr) {
+        return;
+    }
+
+    android::sp<MemoryBlock> block = heap->allocate(64);
+    ASSERT_NE(nullptr, block.get());
+    ASSERT_EQ(0u, block->offset());
+    uint64_t available = heap->available();
+
+    // Blocks that are free, partly free, or inside a free block.
+    EXPECT_FALSE(release(64, 0));
+    EXPECT_FALSE(release(2048, 5));
+    EXPECT_FALSE(release(2048 + 64, 0));
+    EXPECT_FALSE(release(0, 2));
+    EXPECT_EQ(available, heap->available());
+
+    // Freeing it behind the block's back makes the block's own free a double
+    // free, which leaves the heap intact.
+    EXPECT_TRUE(release(0, 0));
+    EXPECT_EQ(4096u, heap->available());
+    block.clear();
+    EXPECT_EQ(4096u, heap->available());
+    android::sp<MemoryBlock> whole = heap->allocate(4096);
+    ASSERT_NE(nullptr, whole.get());
+    EXPECT_EQ(nullptr, heap->allocate(64).get());
+}
+
+TEST_F(MemoryHeapTest, OutOfRangeFreeTest) {
+    if (heap == nullptr) {
+        return;
+    }
+
+    android::sp<MemoryBlock> whole = heap->allocate(4096);
+    ASSERT_NE(nullptr, whole.get());
+
+    EXPECT_FALSE(release(4096, 0));
+    EXPECT_FALSE(release(UINT64_MAX & ~uint64_t(63), 0));
+    EXPECT_FALSE(release(32, 0));   // misaligned
+    EXPECT_FALSE(release(64, 1));   // misaligned for its order
+    EXPECT_FALSE(release(0, 7));    // larger than the heap
+    EXPECT_EQ(0u, heap->available());
+    EXPECT_EQ(nullptr, heap->allocate(64).get());
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
@@ -0,0 +1,261 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "HidlSupport"
+
+#include "FlatParcel.h"
+
+#include <hwbinder/ProcessState.h>
+#include <log/log.h>
+
+#include <string.h>
+
+namespace android {
+namespace hardware {
+namespace details {
+
+static size_t align8(size_t size) {
+    return (size + 7) & ~static_cast<size_t>(7);
+}
+
+static size_t objectsStart(const FlatParcelLayout &layout) {
+    return align8(layout.dataSize);
+}
+
+static size_t buffersStart(const FlatParcelLayout &layout) {
+    return objectsStart(layout) + align8(layout.objectsCount * sizeof(binder_size_t));
+}
+
+static bool isPlainBuffer(const binder_buffer_object *object) {
+    // References to other buffers carry other flags.
+    return (object->flags & ~BINDER_BUFFER_FLAG_HAS_PARENT) == 0;
+}
+
+FlatParcelLayout flatParcelLayout(const Parcel &parcel) {
+    FlatParcelLayout layout{parcel.ipcDataSize(), parcel.ipcObjectsCount(), 0};
+    layout.size = buffersStart(layout);
+
+    const uint8_t *data = reinterpret_cast<const uint8_t *>(parcel.ipcData());
+    const binder_size_t *objects = reinterpret_cast<const binder_size_t *>(parcel.ipcObjects());
+    for (size_t i = 0; i < layout.objectsCount; i++) {
+        const binder_object_header *header =
+                reinterpret_cast<const binder_object_header *>(data + objects[i]);
+        if (header->type == BINDER_TYPE_PTR) {
+            layout.size += align8(reinterpret_cast<const binder_buffer_object *>(header)->length);
+        }
+    }
+    return layout;
+}
+
+binder_size_t *flatParcelObjects(uint8_t *block, const FlatParcelLayout &layout) {
+    return reinterpret_cast<binder_size_t *>(block + objectsStart(layout));
+}
+
+status_t flattenParcel(const Parcel &parcel, const FlatParcelLayout &layout, uint8_t *block,
+                       std::vector<int> *fds, std::vector<sp<IBinder>> *binders) {
+    const uint8_t *data = reinterpret_cast<const uint8_t *>(parcel.ipcData());
+    const binder_size_t *objects = reinterpret_cast<const binder_size_t *>(parcel.ipcObjects());
+    binder_size_t *newObjects = flatParcelObjects(block, layout);
+    memcpy(block, data, layout.dataSize);
+    memcpy(newObjects, objects, layout.objectsCount * sizeof(binder_size_t));
+
+    size_t next = buffersStart(layout);
+    for (size_t i = 0; i < layout.objectsCount; i++) {
+        binder_object_header *header = reinterpret_cast<binder_object_header *>(block + objects[i]);
+        switch (header->type) {
+            case BINDER_TYPE_PTR: {
+                binder_buffer_object *object = reinterpret_cast<binder_buffer_object *>(header);
+                if (!isPlainBuffer(object)) {
+                    ALOGE("References between buffers can't be flattened.");
+                    return INVALID_OPERATION;
+                }
+                if (object->buffer != 0) {
+                    memcpy(block + next, reinterpret_cast<const void *>(object->buffer),
+                           object->length);
+                    object->buffer = next;
+                    next += align8(object->length);
+                }
+                break;
+            }
+            case BINDER_TYPE_FD: {
+                if (fds != nullptr) {
+                    fds->push_back(reinterpret_cast<binder_fd_object *>(header)->fd);
+                }
+                break;
+            }
+            case BINDER_TYPE_FDA: {
+                if (fds == nullptr) {
+                    break;
+                }
+                const binder_fd_array_object *object =
+                        reinterpret_cast<const binder_fd_array_object *>(header);
+                // The fds themselves are in the parent buffer, still unmoved in parcel.
+                const binder_buffer_object *parent = reinterpret_cast<const binder_buffer_object *>(
+                        data + objects[object->parent]);
+                const uint8_t *array = reinterpret_cast<const uint8_t *>(parent->buffer) +
+                        object->parent_offset;
+                for (size_t j = 0; j < object->num_fds; j++) {
+                    uint32_t fd;
+                    memcpy(&fd, array + j * sizeof(fd), sizeof(fd));
+                    fds->push_back(fd);
+                }
+                break;
+            }
+            case BINDER_TYPE_BINDER:
+            case BINDER_TYPE_HANDLE: {
+                if (binders == nullptr) {
+                    ALOGE("Binders can't be sent over this transport.");
+                    return INVALID_OPERATION;
+                }
+                const flat_binder_object *object =
+                        reinterpret_cast<const flat_binder_object *>(header);
+                // The sending Parcel holds references to these, which it may
+                // drop before the receiver reads them.
+                if (header->type == BINDER_TYPE_BINDER) {
+                    binders->push_back(reinterpret_cast<IBinder *>(object->cookie));
+                } else {
+                    binders->push_back(
+                            ProcessState::self()->getStrongProxyForHandle(object->handle));
+                }
+                break;
+            }
+            default:
+                if (binders == nullptr) {
+                    ALOGE("Object of type 0x%x can't be sent over this transport.",
+                          header->type);
+                    return INVALID_OPERATION;
+                }
+                break;
+        }
+    }
+    return OK;
+}
+
+status_t unflattenParcel(uint8_t *block, const FlatParcelLayout &layout,
+                         const std::vector<int> *fds) {
+    const size_t dataSize = layout.dataSize;
+    if (dataSize > layout.size || objectsStart(layout) > layout.size ||
+            layout.objectsCount > (layout.size - objectsStart(layout)) / sizeof(binder_size_t) ||
+            buffersStart(layout) > layout.size) {
+        ALOGE("Bad flattened Parcel layout.");
+        return BAD_VALUE;
+    }
+    const binder_size_t *objects = flatParcelObjects(block, layout);
+    const size_t buffersOffset = buffersStart(layout);
+
+    struct Buffer {
+        uint8_t *data;
+        size_t length;
+    };
+    std::vector<Buffer> buffers(layout.objectsCount, Buffer{nullptr, 0});
+    // Whether [offset, offset + length) is within parent's buffer.
+    auto inParent = [&](size_t i, binder_size_t parent, binder_size_t offset, size_t length) {
+        return parent < i && buffers[parent].data != nullptr &&
+                offset <= buffers[parent].length && length <= buffers[parent].length - offset;
+    };
+    size_t nextFd = 0;
+
+    for (size_t i = 0; i < layout.objectsCount; i++) {
+        const binder_size_t offset = objects[i];
+        if (offset % sizeof(uint32_t) != 0 || offset > dataSize ||
+                dataSize - offset < sizeof(binder_object_header)) {
+            ALOGE("Bad offset for object %zu in flattened Parcel.", i);
+            return BAD_VALUE;
+        }
+        const size_t room = dataSize - offset;
+        binder_object_header *header = reinterpret_cast<binder_object_header *>(block + offset);
+
+        switch (header->type) {
+            case BINDER_TYPE_PTR: {
+                binder_buffer_object *object = reinterpret_cast<binder_buffer_object *>(header);
+                if (room < sizeof(*object) || !isPlainBuffer(object)) {
+                    return BAD_VALUE;
+                }
+                binder_uintptr_t address = 0;
+                if (object->buffer != 0) {
+                    if (object->buffer < buffersOffset || object->buffer > layout.size ||
+                            object->length > layout.size - object->buffer) {
+                        ALOGE("Bad buffer %zu in flattened Parcel.", i);
+                        return BAD_VALUE;
+                    }
+                    buffers[i] = Buffer{block + object->buffer, object->length};
+                    address = reinterpret_cast<binder_uintptr_t>(block + object->buffer);
+                }
+                if ((object->flags & BINDER_BUFFER_FLAG_HAS_PARENT) != 0) {
+                    if (!inParent(i, object->parent, object->parent_offset, sizeof(address))) {
+                        ALOGE("Bad parent for buffer %zu in flattened Parcel.", i);
+                        return BAD_VALUE;
+                    }
+                    memcpy(buffers[object->parent].data + object->parent_offset, &address,
+                           sizeof(address));
+                }
+                object->buffer = address;
+                break;
+            }
+            case BINDER_TYPE_FD: {
+                binder_fd_object *object = reinterpret_cast<binder_fd_object *>(header);
+                if (room < sizeof(*object)) {
+                    return BAD_VALUE;
+                }
+                if (fds != nullptr) {
+                    if (nextFd >= fds->size()) {
+                        return BAD_VALUE;
+                    }
+                    object->fd = (*fds)[nextFd++];
+                }
+                break;
+            }
+            case BINDER_TYPE_FDA: {
+                const binder_fd_array_object *object =
+                        reinterpret_cast<const binder_fd_array_object *>(header);
+                if (room < sizeof(*object) || object->num_fds > layout.size / sizeof(uint32_t) ||
+                        !inParent(i, object->parent, object->parent_offset,
+                                  object->num_fds * sizeof(uint32_t))) {
+                    ALOGE("Bad fd array %zu in flattened Parcel.", i);
+                    return BAD_VALUE;
+                }
+                if (fds != nullptr) {
+                    if (object->num_fds > fds->size() - nextFd) {
+                        return BAD_VALUE;
+                    }
+                    uint8_t *array = buffers[object->parent].data + object->parent_offset;
+                    for (size_t j = 0; j < object->num_fds; j++) {
+                        uint32_t fd = (*fds)[nextFd++];
+                        memcpy(array + j * sizeof(fd), &fd, sizeof(fd));
+                    }
+                }
+                break;
+            }
+            default:
+                // Binders only make sense within this process.
+                if (fds != nullptr) {
+                    ALOGE("Unexpected object of type 0x%x in flattened Parcel.", header->type);
+                    return BAD_VALUE;
+                }
+                break;
+        }
+    }
+
+    if (fds != nullptr && nextFd != fds->size()) {
+        ALOGE("Flattened Parcel came with %zu fds but uses %zu.", fds->size(), nextFd);
+        return BAD_VALUE;
+    }
+    return OK;
+}
+
+}  // namespace details
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HIDL_FLAT_PARCEL_H
+#define ANDROID_HIDL_FLAT_PARCEL_H
+
+#include <hwbinder/IBinder.h>
+#include <hwbinder/Parcel.h>
+#include <linux/android/binder.h>
+#include <utils/StrongPointer.h>
+
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace details {
+
+// A Parcel's contents in one block, as the binder driver copies them: the
+// data, then the object offsets, then every buffer, each 8-byte aligned.
+// In a flattened block, buffer objects refer to their copies by offset from
+// the start of the block, so the block can be moved, e.x. to another process,
+// until unflattenParcel fixes those up into addresses.
+struct FlatParcelLayout {
+    size_t dataSize;
+    size_t objectsCount;
+    size_t size;  // of the whole block
+};
+
+FlatParcelLayout flatParcelLayout(const Parcel &parcel);
+
+// Where the object offsets start in a block.
+binder_size_t *flatParcelObjects(uint8_t *block, const FlatParcelLayout &layout);
+
+// Copies parcel into block, which has layout.size bytes. The file descriptors
+// in parcel are appended to fds and the binders to binders, in order. With a
+// nullptr fds, file descriptors are copied as they are; with a nullptr
+// binders, a Parcel holding binders is rejected.
+status_t flattenParcel(const Parcel &parcel, const FlatParcelLayout &layout, uint8_t *block,
+                       std::vector<int> *fds, std::vector<sp<IBinder>> *binders);
+
+// Checks a flattened block and fixes its buffers up to point at where they
+// are now. fds is nullptr for a block from this process; otherwise the block
+// came from another, its file descriptors are replaced in order with fds, and
+// binders in it are rejected.
+status_t unflattenParcel(uint8_t *block, const FlatParcelLayout &layout,
+                         const std::vector<int> *fds);
+
+}  // namespace details
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HIDL_FLAT_PARCEL_H
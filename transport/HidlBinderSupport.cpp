@@ -18,11 +18,18 @@
 
 #include <hidl/HidlBinderSupport.h>
 
+#include <android-base/properties.h>
+
 // C includes
+#include <linux/android/binder.h>
+#include <string.h>
 #include <unistd.h>
 
 // C++ includes
+#include <algorithm>
+#include <atomic>
 #include <fstream>
+#include <map>
 #include <sstream>
 
 namespace android {
@@ -89,6 +96,20 @@ status_t writeEmbeddedToParcel(const hidl_memory &memory,
 const size_t hidl_string::kOffsetOfBuffer = offsetof(hidl_string, mBuffer);
 static_assert(hidl_string::kOffsetOfBuffer == 0, "wrong offset");
 
+static std::atomic<bool>& strictStringValidation() {
+    static std::atomic<bool> enabled(
+            android::base::GetBoolProperty("hidl.strict_strings", false));
+    return enabled;
+}
+
+void setStrictStringValidation(bool enabled) {
+    strictStringValidation() = enabled;
+}
+
+bool isStrictStringValidationEnabled() {
+    return strictStringValidation().load(std::memory_order_relaxed);
+}
+
 status_t readEmbeddedFromParcel(const hidl_string &string ,
         const Parcel &parcel, size_t parentHandle, size_t parentOffset) {
     const void *out;
@@ -110,6 +131,12 @@ status_t readEmbeddedFromParcel(const hidl_string &string ,
         return BAD_VALUE;
     }
 
+    if (isStrictStringValidationEnabled() &&
+            !details::isWellFormedString(static_cast<const char *>(out), string.size())) {
+        ALOGE("Received hidl_string with an embedded NUL or invalid UTF-8.");
+        return BAD_VALUE;
+    }
+
     return OK;
 }
 
@@ -123,6 +150,79 @@ status_t writeEmbeddedToParcel(const hidl_string &string,
             parentOffset + hidl_string::kOffsetOfBuffer);
 }
 
+namespace details {
+
+static const binder_size_t *objectOffsets(const Parcel *parcel) {
+    return reinterpret_cast<const binder_size_t *>(parcel->ipcObjects());
+}
+
+// Returns nullptr unless object i of parcel is a buffer or reference.
+static const binder_buffer_object *bufferObjectAt(const Parcel *parcel, size_t i) {
+    const binder_buffer_object *object = reinterpret_cast<const binder_buffer_object *>(
+            parcel->ipcData() + objectOffsets(parcel)[i]);
+    return object->hdr.type == BINDER_TYPE_PTR ? object : nullptr;
+}
+
+void ParcelBufferIndex::update() {
+    const size_t count = mParcel->ipcObjectsCount();
+    if (count < mIndexedObjects) {
+        // Objects were removed, which the index doesn't support; start over
+        // rather than hand out handles that no longer exist.
+        ALOGE("Parcel lost objects while its buffers were indexed.");
+        mIndexedObjects = 0;
+        mMaxLength = 0;
+        mBuffers.clear();
+    }
+
+    for (size_t i = mIndexedObjects; i < count; i++) {
+        const binder_buffer_object *object = bufferObjectAt(mParcel, i);
+        // Only plain buffers; references to other buffers carry other flags.
+        if (object == nullptr || (object->flags & ~BINDER_BUFFER_FLAG_HAS_PARENT) != 0) {
+            continue;
+        }
+        mBuffers.emplace(object->buffer, Buffer{object->buffer + object->length, i});
+        mMaxLength = std::max<uintptr_t>(mMaxLength, object->length);
+    }
+    mIndexedObjects = count;
+}
+
+status_t ParcelBufferIndex::findBuffer(const Parcel *parcel, const void *ptr, size_t length,
+        bool *found, size_t *handle, size_t *offset) {
+    const uintptr_t start = reinterpret_cast<uintptr_t>(ptr);
+    if (parcel != mParcel || ptr == nullptr || start + length < start) {
+        return BAD_VALUE;
+    }
+
+    update();
+
+    // Like Parcel::findBuffer, take the buffer written first (i.e. with the
+    // lowest handle) that ptr starts in; ptr + length must fit in it.
+    *found = false;
+    uintptr_t end = 0;
+    auto it = mBuffers.upper_bound(start);
+    while (it != mBuffers.begin()) {
+        --it;
+        if (start - it->first > mMaxLength) {
+            break;
+        }
+        if (start < it->second.end && (!*found || it->second.handle < *handle)) {
+            *found = true;
+            *handle = it->second.handle;
+            *offset = start - it->first;
+            end = it->second.end;
+        }
+    }
+    if (*found && start + length > end) {
+        ALOGE("Pointer %p with length %zu runs past the end of buffer %zu.", ptr, length,
+              *handle);
+        *found = false;
+        return BAD_VALUE;
+    }
+    return OK;
+}
+
+}  // namespace details
+
 android::status_t writeToParcel(const hidl_version &version, android::hardware::Parcel& parcel) {
     return parcel.writeUint32(static_cast<uint32_t>(version.get_major()) << 16 | version.get_minor());
 }
@@ -137,6 +237,11 @@ hidl_version* readFromParcel(const android::hardware::Parcel& parcel) {
     }
 }
 
+// Exception messages are UTF-16 on the wire for Java peers, but are nearly
+// always short ASCII (e.x. "Permission denied"), which is converted on the
+// stack here instead of through String16 and String8.
+static constexpr size_t kMaxInlineMessageLength = 256;
+
 status_t readFromParcel(Status *s, const Parcel& parcel) {
     int32_t exception;
     status_t status = parcel.readInt32(&exception);
@@ -167,14 +272,27 @@ status_t readFromParcel(Status *s, const Parcel& parcel) {
     }
 
     // The remote threw an exception.  Get the message back.
-    String16 message;
-    status = parcel.readString16(&message);
-    if (status != OK) {
-        s->setFromStatusT(status);
-        return status;
+    size_t length;
+    const char16_t *message = parcel.readString16Inplace(&length);
+    if (message == nullptr) {
+        s->setFromStatusT(UNEXPECTED_NULL);
+        return UNEXPECTED_NULL;
     }
 
-    s->setException(exception, String8(message));
+    if (length <= kMaxInlineMessageLength) {
+        char ascii[kMaxInlineMessageLength + 1];
+        size_t i = 0;
+        for (; i < length && message[i] < 0x80; i++) {
+            ascii[i] = static_cast<char>(message[i]);
+        }
+        if (i == length) {
+            ascii[length] = '\0';
+            s->setException(exception, ascii);
+            return status;
+        }
+    }
+
+    s->setException(exception, String8(message, length).string());
 
     return status;
 }
@@ -192,7 +310,19 @@ status_t writeToParcel(const Status &s, Parcel* parcel) {
         // We have no more information to write.
         return status;
     }
-    status = parcel->writeString16(String16(s.exceptionMessage()));
+    const char *message = s.exceptionMessage();
+    const size_t length = strlen(message);
+    if (length <= kMaxInlineMessageLength) {
+        char16_t utf16[kMaxInlineMessageLength];
+        size_t i = 0;
+        for (; i < length && static_cast<unsigned char>(message[i]) < 0x80; i++) {
+            utf16[i] = message[i];
+        }
+        if (i == length) {
+            return parcel->writeString16(utf16, length);
+        }
+    }
+    status = parcel->writeString16(String16(message, length));
     return status;
 }
 
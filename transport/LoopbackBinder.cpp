@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "HidlSupport"
+
+#include <hidl/LoopbackBinder.h>
+
+#include <android-base/properties.h>
+
+#include <stdlib.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "FlatParcel.h"
+
+namespace android {
+namespace hardware {
+namespace details {
+
+static std::atomic<bool>& loopbackTransport() {
+#ifdef LIBHIDL_TARGET_DEBUGGABLE
+    // Only debuggable builds let a property switch every process over.
+    static std::atomic<bool> enabled(android::base::GetBoolProperty("hidl.loopback", false));
+#else
+    static std::atomic<bool> enabled(false);
+#endif
+    return enabled;
+}
+
+void setLoopbackTransportEnabled(bool enabled) {
+    loopbackTransport() = enabled;
+}
+
+bool isLoopbackTransportEnabled() {
+    return loopbackTransport().load(std::memory_order_relaxed);
+}
+
+// What a delivered Parcel owns until it is freed.
+struct Delivery {
+    ~Delivery() { free(block); }
+
+    uint8_t *block = nullptr;
+    // The binders in it, see flattenParcel.
+    std::vector<sp<IBinder>> binders;
+};
+
+static void releaseDelivery(Parcel * /* parcel */, const uint8_t * /* data */,
+        size_t /* dataSize */, const binder_size_t * /* objects */, size_t /* objectsCount */,
+        void *cookie) {
+    delete static_cast<Delivery *>(cookie);
+}
+
+status_t deliverParcel(const Parcel &from, Parcel *to) {
+    const FlatParcelLayout layout = flatParcelLayout(from);
+
+    std::unique_ptr<Delivery> delivery(new Delivery());
+    delivery->block = static_cast<uint8_t *>(malloc(layout.size));
+    if (delivery->block == nullptr && layout.size > 0) {
+        return NO_MEMORY;
+    }
+
+    status_t status = flattenParcel(from, layout, delivery->block, nullptr /* fds */,
+                                    &delivery->binders);
+    if (status == OK) {
+        status = unflattenParcel(delivery->block, layout, nullptr /* fds */);
+    }
+    if (status != OK) {
+        return status;
+    }
+
+    uint8_t *block = delivery->block;
+    to->ipcSetDataReference(block, layout.dataSize, flatParcelObjects(block, layout),
+                            layout.objectsCount, releaseDelivery, delivery.release());
+    return OK;
+}
+
+static const int kLoopbackSubclassId = 0;
+
+LoopbackBinder::LoopbackBinder(const sp<IBinder> &target) : mTarget(target) {}
+
+sp<IBinder> LoopbackBinder::unwrap(const sp<IBinder> &binder) {
+    if (binder != nullptr && binder->checkSubclass(&kLoopbackSubclassId)) {
+        return static_cast<LoopbackBinder *>(binder.get())->target();
+    }
+    return binder;
+}
+
+status_t LoopbackBinder::transact(uint32_t code, const Parcel &data, Parcel *reply,
+                                  uint32_t flags, TransactCallback callback) {
+    Parcel request;
+    status_t status = deliverParcel(data, &request);
+    if (status != OK) {
+        return status;
+    }
+
+    Parcel onewayReply;
+    Parcel *out = reply != nullptr ? reply : &onewayReply;
+    bool delivered = false;
+    status_t deliveryStatus = OK;
+    status = mTarget->transact(code, request, out, flags, [&](Parcel &stubReply) {
+        // The reply can point into the stub's stack, so it is copied before
+        // the stub's callback returns, as the driver would send it.
+        deliveryStatus = deliverParcel(stubReply, out);
+        delivered = true;
+    });
+    if (status == OK && !delivered) {
+        deliveryStatus = deliverParcel(*out, out);
+    }
+    if (status == OK) {
+        status = deliveryStatus;
+    }
+    if (status == OK && callback) {
+        callback(*out);
+    }
+    return status;
+}
+
+status_t LoopbackBinder::linkToDeath(const sp<DeathRecipient> &recipient, void *cookie,
+                                     uint32_t flags) {
+    return mTarget->linkToDeath(recipient, cookie, flags);
+}
+
+status_t LoopbackBinder::unlinkToDeath(const wp<DeathRecipient> &recipient, void *cookie,
+                                       uint32_t flags, wp<DeathRecipient> *outRecipient) {
+    return mTarget->unlinkToDeath(recipient, cookie, flags, outRecipient);
+}
+
+bool LoopbackBinder::checkSubclass(const void *subclassID) const {
+    return subclassID == &kLoopbackSubclassId;
+}
+
+void LoopbackBinder::attachObject(const void *objectID, void *object, void *cleanupCookie,
+                                  object_cleanup_func func) {
+    mTarget->attachObject(objectID, object, cleanupCookie, func);
+}
+
+void *LoopbackBinder::findObject(const void *objectID) const {
+    return mTarget->findObject(objectID);
+}
+
+void LoopbackBinder::detachObject(const void *objectID) {
+    mTarget->detachObject(objectID);
+}
+
+}  // namespace details
+}  // namespace hardware
+}  // namespace android
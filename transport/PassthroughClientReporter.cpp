@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "HidlServiceManagement"
+
+#include "PassthroughClientReporter.h"
+
+#include <android-base/logging.h>
+#include <hidl/TaskRunner.h>
+
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace details {
+
+using Reference = std::pair<std::string, std::string>;
+
+struct PassthroughClientReporter::State {
+    State(const Sender &sender, std::chrono::milliseconds initialBackoff,
+          std::chrono::milliseconds maxBackoff)
+        : sender(sender), initialBackoff(initialBackoff), maxBackoff(maxBackoff),
+          backoff(initialBackoff) {
+        // One flush is queued at a time; see flushScheduled.
+        runner.start(1 /* limit */);
+    }
+
+    const Sender sender;
+    const std::chrono::milliseconds initialBackoff;
+    const std::chrono::milliseconds maxBackoff;
+    TaskRunner runner;
+
+    std::mutex mutex;
+    // interface name -> instance names that are sent, or pending
+    std::map<std::string, std::set<std::string>> known;
+    std::vector<Reference> pending;
+    // Whether a flush is queued, or waiting to retry, that will send pending.
+    bool flushScheduled = false;
+    // How long to wait before retrying after the next failure.
+    std::chrono::milliseconds backoff;
+};
+
+void PassthroughClientReporter::flush(const std::shared_ptr<State> &state) {
+    std::vector<Reference> pending;
+    {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        pending.swap(state->pending);
+        state->flushScheduled = false;
+    }
+
+    std::vector<Reference> failed;
+    for (const Reference &reference : pending) {
+        if (!state->sender(reference.first, reference.second)) {
+            failed.push_back(reference);
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    if (failed.empty()) {
+        state->backoff = state->initialBackoff;
+        return;
+    }
+
+    if (state->backoff > state->maxBackoff) {
+        LOG(WARNING) << "Giving up on registerReference for " << failed.size()
+                     << " passthrough client(s) until they are reported again.";
+        for (const Reference &reference : failed) {
+            state->known[reference.first].erase(reference.second);
+        }
+        state->backoff = state->initialBackoff;
+        return;
+    }
+
+    state->pending.insert(state->pending.begin(), failed.begin(), failed.end());
+    const std::chrono::milliseconds delay = state->backoff;
+    state->backoff *= 2;
+    if (!state->flushScheduled) {
+        state->flushScheduled = true;
+        scheduleFlushLocked(state, delay);
+    }
+}
+
+void PassthroughClientReporter::scheduleFlushLocked(const std::shared_ptr<State> &state,
+                                                    std::chrono::milliseconds delay) {
+    // Weak, so that the reporter and its thread go away with its last owner.
+    std::weak_ptr<State> weakState = state;
+    bool pushed = state->runner.push([weakState, delay] {
+        if (delay.count() > 0) {
+            std::this_thread::sleep_for(delay);
+        }
+        std::shared_ptr<State> locked = weakState.lock();
+        if (locked != nullptr) {
+            flush(locked);
+        }
+    });
+    if (!pushed) {
+        // Never flushed here, since that would put the IPC back on the
+        // getService path; the pending references go out with the next report.
+        LOG(WARNING) << "Could not schedule registerReference.";
+        state->flushScheduled = false;
+    }
+}
+
+PassthroughClientReporter::PassthroughClientReporter(const Sender &sender,
+                                                     std::chrono::milliseconds initialBackoff,
+                                                     std::chrono::milliseconds maxBackoff)
+    : mState(std::make_shared<State>(sender, initialBackoff, maxBackoff)) {}
+
+void PassthroughClientReporter::report(const std::string &interfaceName,
+                                       const std::string &instanceName) {
+    std::unique_lock<std::mutex> lock(mState->mutex);
+    if (!mState->known[interfaceName].insert(instanceName).second) {
+        return;
+    }
+    mState->pending.emplace_back(interfaceName, instanceName);
+    if (mState->flushScheduled) {
+        return;
+    }
+    mState->flushScheduled = true;
+    scheduleFlushLocked(mState, std::chrono::milliseconds::zero());
+}
+
+}  // namespace details
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HIDL_PASSTHROUGH_CLIENT_REPORTER_H
+#define ANDROID_HIDL_PASSTHROUGH_CLIENT_REPORTER_H
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace android {
+namespace hardware {
+namespace details {
+
+// Tells hwservicemanager that this process is a client of a passthrough
+// service. This is only used for debugging (lshal), so it is kept off the
+// getService path: references are deduplicated per process and sent in
+// batches from a background thread.
+//
+// A reference that fails to be sent is sent again from that thread, after
+// a delay that starts at initialBackoff and doubles with each failure. Once
+// it would exceed maxBackoff, the references that failed are dropped until
+// they are reported again.
+class PassthroughClientReporter {
+public:
+    // Sends one reference. Returns false if it could not be sent.
+    using Sender = std::function<bool(const std::string &interfaceName,
+                                      const std::string &instanceName)>;
+
+    PassthroughClientReporter(const Sender &sender, std::chrono::milliseconds initialBackoff,
+                              std::chrono::milliseconds maxBackoff);
+
+    // Returns without waiting for the reference to be sent.
+    void report(const std::string &interfaceName, const std::string &instanceName);
+
+private:
+    struct State;
+
+    static void flush(const std::shared_ptr<State> &state);
+    // Queues a flush, after delay. Must be called with the flush marked as
+    // scheduled, which it is no longer if the flush can't be queued.
+    static void scheduleFlushLocked(const std::shared_ptr<State> &state,
+                                    std::chrono::milliseconds delay);
+
+    std::shared_ptr<State> mState;
+};
+
+}  // namespace details
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HIDL_PASSTHROUGH_CLIENT_REPORTER_H
@@ -20,20 +20,29 @@
 #include <condition_variable>
 #include <dlfcn.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <fstream>
 #include <pthread.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <map>
 #include <mutex>
-#include <regex>
 #include <set>
+#include <thread>
+#include <unordered_map>
 
 #include <hidl/HidlBinderSupport.h>
 #include <hidl/ServiceManagement.h>
 #include <hidl/Status.h>
+#include <hidl/TaskRunner.h>
+#include <hidl/WorkerPool.h>
 
 #include <android-base/logging.h>
 #include <android-base/properties.h>
+#include <android-base/unique_fd.h>
 #include <hwbinder/IPCThreadState.h>
 #include <hwbinder/Parcel.h>
 #include <vndksupport/linker.h>
@@ -42,15 +51,16 @@
 #include <android/hidl/manager/1.1/BpHwServiceManager.h>
 #include <android/hidl/manager/1.1/BnHwServiceManager.h>
 
-#define RE_COMPONENT    "[a-zA-Z_][a-zA-Z_0-9]*"
-#define RE_PATH         RE_COMPONENT "(?:[.]" RE_COMPONENT ")*"
-static const std::regex gLibraryFileNamePattern("(" RE_PATH "@[0-9]+[.][0-9]+)-impl(.*?).so");
+#include "PassthroughClientReporter.h"
 
+using android::base::GetProperty;
 using android::base::WaitForProperty;
 
+using android::hidl::base::V1_0::IBase;
 using IServiceManager1_0 = android::hidl::manager::V1_0::IServiceManager;
 using IServiceManager1_1 = android::hidl::manager::V1_1::IServiceManager;
 using android::hidl::manager::V1_0::IServiceNotification;
+using Transport = IServiceManager1_0::Transport;
 using android::hidl::manager::V1_1::BpHwServiceManager;
 using android::hidl::manager::V1_1::BnHwServiceManager;
 
@@ -67,22 +77,27 @@ static const char* kHwServicemanagerReadyProperty = "hwservicemanager.ready";
 void waitForHwServiceManager() {
     using std::literals::chrono_literals::operator""s;
 
-    while (!WaitForProperty(kHwServicemanagerReadyProperty, "true", 1s)) {
-        LOG(WARNING) << "Waited for hwservicemanager.ready for a second, waiting another...";
+    if (WaitForProperty(kHwServicemanagerReadyProperty, "true", 1s)) {
+        return;
     }
+
+    // WaitForProperty blocks on the property serial, so waiting without a
+    // timeout doesn't wake up until the property actually changes.
+    LOG(WARNING) << "Waited for hwservicemanager.ready for a second, waiting indefinitely...";
+    WaitForProperty(kHwServicemanagerReadyProperty, "true");
 }
 
 bool endsWith(const std::string &in, const std::string &suffix) {
     return in.size() >= suffix.size() &&
-           in.substr(in.size() - suffix.size()) == suffix;
+           in.compare(in.size() - suffix.size(), suffix.size(), suffix) == 0;
 }
 
 bool startsWith(const std::string &in, const std::string &prefix) {
     return in.size() >= prefix.size() &&
-           in.substr(0, prefix.size()) == prefix;
+           in.compare(0, prefix.size(), prefix) == 0;
 }
 
-std::string binaryName() {
+std::string readBinaryName() {
     std::ifstream ifs("/proc/self/cmdline");
     std::string cmdline;
     if (!ifs.is_open()) {
@@ -98,8 +113,23 @@ std::string binaryName() {
     return cmdline;
 }
 
+// The command line doesn't change for the life of the process, so it is only
+// read once.
+const std::string &binaryName() {
+    static const std::string name = readBinaryName();
+    return name;
+}
+
+// Set once the process name has been shortened. There is nothing left to do
+// after that, so further registrations skip the check entirely.
+static std::atomic<bool> gProcessNameShortened(false);
+
 void tryShortenProcessName(const std::string &packageName) {
-    std::string processName = binaryName();
+    if (gProcessNameShortened.load(std::memory_order_acquire)) {
+        return;
+    }
+
+    const std::string &processName = binaryName();
 
     if (!startsWith(processName, packageName)) {
         return;
@@ -121,6 +151,10 @@ void tryShortenProcessName(const std::string &packageName) {
     int rc = pthread_setname_np(pthread_self(), newName.c_str());
     ALOGI_IF(rc != 0, "Removing namespace from process name %s failed.",
             processName.c_str());
+
+    if (rc == 0) {
+        gProcessNameShortened.store(true, std::memory_order_release);
+    }
 }
 
 namespace details {
@@ -131,6 +165,45 @@ void onRegistration(const std::string &packageName,
     tryShortenProcessName(packageName);
 }
 
+status_t registerAsServices(const sp<IBase> &service,
+                            const std::string &descriptor,
+                            const std::vector<std::string> &instanceNames) {
+    if (service == nullptr) {
+        return BAD_VALUE;
+    }
+
+    // e.x. android.hardware.foo@1.0::IFoo -> android.hardware.foo@1.0, IFoo
+    size_t sep = descriptor.find("::");
+    if (sep == std::string::npos) {
+        LOG(ERROR) << "Invalid interface descriptor " << descriptor;
+        return BAD_VALUE;
+    }
+    std::string packageName = descriptor.substr(0, sep);
+    std::string interfaceName = descriptor.substr(sep + 2);
+
+    if (instanceNames.empty()) {
+        return OK;
+    }
+    onRegistration(packageName, interfaceName, instanceNames.front());
+
+    const sp<IServiceManager1_0> sm = defaultServiceManager();
+    if (sm == nullptr) {
+        return INVALID_OPERATION;
+    }
+
+    status_t status = OK;
+    for (const std::string &instanceName : instanceNames) {
+        Return<bool> ret = sm->add(instanceName, service);
+        if (!ret.isOk() || !ret) {
+            LOG(ERROR) << "Could not register " << descriptor << "/" << instanceName;
+            if (status == OK) {
+                status = UNKNOWN_ERROR;
+            }
+        }
+    }
+    return status;
+}
+
 }  // details
 
 sp<IServiceManager1_0> defaultServiceManager() {
@@ -187,96 +260,261 @@ std::vector<std::string> search(const std::string &path,
 }
 
 bool matchPackageName(const std::string& lib, std::string* matchedName, std::string* implName) {
-    std::smatch match;
-    if (std::regex_match(lib, match, gLibraryFileNamePattern)) {
-        *matchedName = match.str(1) + "::I*";
-        *implName = match.str(2);
+    size_t fqPackageLength;
+    const char* suffix;
+    size_t suffixLength;
+    if (details::matchPassthroughLibraryName(lib.c_str(), lib.size(), &fqPackageLength,
+                                             &suffix, &suffixLength)) {
+        *matchedName = lib.substr(0, fqPackageLength) + "::I*";
+        implName->assign(suffix, suffixLength);
         return true;
     }
     return false;
 }
 
-static void registerReference(const hidl_string &interfaceName, const hidl_string &instanceName) {
-    sp<IServiceManager1_0> binderizedManager = defaultServiceManager();
-    if (binderizedManager == nullptr) {
-        LOG(WARNING) << "Could not registerReference for "
-                     << interfaceName << "/" << instanceName
-                     << ": null binderized manager.";
-        return;
+// Reports the passthrough services this process gets to hwservicemanager, for lshal.
+static details::PassthroughClientReporter& passthroughClientReporter() {
+    using std::literals::chrono_literals::operator""ms;
+    using std::literals::chrono_literals::operator""s;
+
+    static details::PassthroughClientReporter* reporter = new details::PassthroughClientReporter(
+            [](const std::string& interfaceName, const std::string& instanceName) {
+                sp<IServiceManager1_0> binderizedManager = defaultServiceManager();
+                if (binderizedManager == nullptr) {
+                    LOG(WARNING) << "Could not registerReference for " << interfaceName << "/"
+                                 << instanceName << ": null binderized manager.";
+                    return false;
+                }
+                auto ret = binderizedManager->registerPassthroughClient(interfaceName,
+                                                                        instanceName);
+                if (!ret.isOk()) {
+                    LOG(WARNING) << "Could not registerReference for " << interfaceName << "/"
+                                 << instanceName << ": " << ret.description();
+                    return false;
+                }
+                LOG(VERBOSE) << "Successfully registerReference for " << interfaceName << "/"
+                             << instanceName;
+                return true;
+            },
+            100ms /* initialBackoff */, 60s /* maxBackoff */);
+    return *reporter;
+}
+
+using InstanceDebugInfo = hidl::manager::V1_0::IServiceManager::InstanceDebugInfo;
+
+using LibraryPathSet = std::set<std::string>;
+
+// What we last found in a process's maps. procfs gives maps no modification
+// time, so they are read on every dump, but they are only matched against the
+// libraries again if their contents changed.
+struct ProcessLibraries {
+    uint64_t mapsHash = 0;
+    size_t mapsSize = 0;
+    std::vector<std::string> libraries;
+};
+
+static constexpr size_t kMapsBufferSize = 64 * 1024;
+static constexpr size_t kMaxMapsScanThreads = 4;
+
+// Reads all of /proc/<pid>/maps into *buffer. Returns false if the process
+// has exited, or its maps can't be read.
+static bool readMaps(pid_t pid, std::vector<char>* buffer) {
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/%d/maps", pid);
+    base::unique_fd fd(TEMP_FAILURE_RETRY(open(path, O_RDONLY | O_CLOEXEC)));
+    if (fd < 0) return false;
+
+    size_t filled = 0;
+    for (;;) {
+        if (buffer->size() - filled < kMapsBufferSize) {
+            buffer->resize(filled + kMapsBufferSize);
+        }
+        ssize_t n = TEMP_FAILURE_RETRY(read(fd, buffer->data() + filled, buffer->size() - filled));
+        if (n < 0) return false;
+        if (n == 0) break;
+        filled += n;
     }
-    auto ret = binderizedManager->registerPassthroughClient(interfaceName, instanceName);
-    if (!ret.isOk()) {
-        LOG(WARNING) << "Could not registerReference for "
-                     << interfaceName << "/" << instanceName
-                     << ": " << ret.description();
-        return;
+    buffer->resize(filled);
+    return true;
+}
+
+// FNV-1a over 8-byte words, so that comparing maps with what was last seen
+// costs little next to reading them.
+static uint64_t hashMaps(const std::vector<char>& maps) {
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= maps.size(); i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, maps.data() + i, sizeof(word));
+        hash = (hash ^ word) * 1099511628211ULL;
+    }
+    for (; i < maps.size(); i++) {
+        hash = (hash ^ static_cast<uint8_t>(maps[i])) * 1099511628211ULL;
     }
-    LOG(VERBOSE) << "Successfully registerReference for "
-                 << interfaceName << "/" << instanceName;
+    return hash;
 }
 
-using InstanceDebugInfo = hidl::manager::V1_0::IServiceManager::InstanceDebugInfo;
-static inline void fetchPidsForPassthroughLibraries(
+// Adds the pathname of a maps line to *mapped if it is in libraries. *name is
+// scratch space, kept by the caller so that lookups don't allocate.
+static void matchMapsLine(const char* begin, const char* end, const LibraryPathSet& libraries,
+                          std::string* name, std::vector<std::string>* mapped) {
+    // The last token of line should look like
+    // vendor/lib64/hw/android.hardware.foo@1.0-impl-extra.so
+    // Use some simple filters to ignore bad lines before looking it up.
+    if (begin == end || end[-1] != 'o') return;
+    const char* space = static_cast<const char*>(memrchr(begin, ' ', end - begin));
+    if (space == nullptr) return;
+    if (memchr(space + 1, '@', end - space - 1) == nullptr) return;
+
+    name->assign(space + 1, end);
+    auto it = libraries.find(*name);
+    if (it == libraries.end()) return;
+    // Each library shows up once per segment.
+    if (std::find(mapped->begin(), mapped->end(), *it) == mapped->end()) {
+        mapped->push_back(*it);
+    }
+}
+
+// Returns the libraries in libraries that are mapped in maps.
+static std::vector<std::string> scanMapsForLibraries(const std::vector<char>& maps,
+                                                     const LibraryPathSet& libraries) {
+    std::vector<std::string> mapped;
+    std::string name;
+    const char* start = maps.data();
+    const char* end = start + maps.size();
+    while (start < end) {
+        const char* newline = static_cast<const char*>(memchr(start, '\n', end - start));
+        const char* lineEnd = newline != nullptr ? newline : end;
+        matchMapsLine(start, lineEnd, libraries, &name, &mapped);
+        start = lineEnd + 1;
+    }
+    return mapped;
+}
+
+static void fetchPidsForPassthroughLibraries(
     std::map<std::string, InstanceDebugInfo>* infos) {
-    static const std::string proc = "/proc/";
+    // Results from previous dumps, valid as long as the library set is the same.
+    static std::mutex sCacheMutex;
+    static LibraryPathSet sCachedLibraries;
+    static std::map<pid_t, ProcessLibraries> sCache;
+
+    LibraryPathSet libraries;
+    for (const auto& pair : *infos) {
+        libraries.insert(pair.first);
+    }
 
-    std::map<std::string, std::set<pid_t>> pids;
-    std::unique_ptr<DIR, decltype(&closedir)> dir(opendir(proc.c_str()), closedir);
-    if (!dir) return;
-    dirent* dp;
-    while ((dp = readdir(dir.get())) != nullptr) {
-        pid_t pid = strtoll(dp->d_name, NULL, 0);
-        if (pid == 0) continue;
-        std::string mapsPath = proc + dp->d_name + "/maps";
-        std::ifstream ifs{mapsPath};
-        if (!ifs.is_open()) continue;
+    std::vector<pid_t> pids;
+    {
+        std::unique_ptr<DIR, decltype(&closedir)> dir(opendir("/proc/"), closedir);
+        if (!dir) return;
+        dirent* dp;
+        while ((dp = readdir(dir.get())) != nullptr) {
+            pid_t pid = strtoll(dp->d_name, NULL, 0);
+            if (pid == 0) continue;
+            pids.push_back(pid);
+        }
+    }
 
-        for (std::string line; std::getline(ifs, line);) {
-            // The last token of line should look like
-            // vendor/lib64/hw/android.hardware.foo@1.0-impl-extra.so
-            // Use some simple filters to ignore bad lines before extracting libFileName
-            // and checking the key in info to make parsing faster.
-            if (line.back() != 'o') continue;
-            if (line.rfind('@') == std::string::npos) continue;
+    std::map<pid_t, ProcessLibraries> cache;
+    {
+        std::unique_lock<std::mutex> lock(sCacheMutex);
+        if (sCachedLibraries == libraries) {
+            cache.swap(sCache);
+        }
+    }
 
-            auto spacePos = line.rfind(' ');
-            if (spacePos == std::string::npos) continue;
-            auto libFileName = line.substr(spacePos + 1);
-            auto it = infos->find(libFileName);
-            if (it == infos->end()) continue;
-            pids[libFileName].insert(pid);
+    std::vector<ProcessLibraries> results(pids.size());
+    std::vector<char> live(pids.size(), false);
+    details::parallelFor(pids.size(), kMaxMapsScanThreads, [&](size_t i) {
+        // Kept by each thread, so reading maps doesn't allocate once it has
+        // grown to fit the largest.
+        static thread_local std::vector<char> maps;
+        if (!readMaps(pids[i], &maps)) return;
+        live[i] = true;
+
+        ProcessLibraries& result = results[i];
+        result.mapsHash = hashMaps(maps);
+        result.mapsSize = maps.size();
+
+        // Only this call looks at this pid, so the cache needs no lock.
+        auto it = cache.find(pids[i]);
+        if (it != cache.end() && it->second.mapsHash == result.mapsHash &&
+            it->second.mapsSize == result.mapsSize) {
+            result.libraries = std::move(it->second.libraries);
+            return;
         }
+        result.libraries = scanMapsForLibraries(maps, libraries);
+    });
+
+    std::map<std::string, std::set<pid_t>> pidsByLibrary;
+    std::map<pid_t, ProcessLibraries> newCache;
+    for (size_t i = 0; i < pids.size(); i++) {
+        // Processes that exited during the dump are left out entirely.
+        if (!live[i]) continue;
+        for (const std::string& library : results[i].libraries) {
+            pidsByLibrary[library].insert(pids[i]);
+        }
+        newCache.emplace(pids[i], std::move(results[i]));
     }
     for (auto& pair : *infos) {
-        pair.second.clientPids =
-            std::vector<pid_t>{pids[pair.first].begin(), pids[pair.first].end()};
+        const std::set<pid_t>& libraryPids = pidsByLibrary[pair.first];
+        pair.second.clientPids = std::vector<pid_t>{libraryPids.begin(), libraryPids.end()};
     }
-}
 
-struct PassthroughServiceManager : IServiceManager1_1 {
-    static void openLibs(const std::string& fqName,
-            std::function<bool /* continue */(void* /* handle */,
-                const std::string& /* lib */, const std::string& /* sym */)> eachLib) {
-        //fqName looks like android.hardware.foo@1.0::IFoo
-        size_t idx = fqName.find("::");
+    std::unique_lock<std::mutex> lock(sCacheMutex);
+    sCachedLibraries = std::move(libraries);
+    sCache = std::move(newCache);
+}
 
-        if (idx == std::string::npos ||
-                idx + strlen("::") + 1 >= fqName.size()) {
-            LOG(ERROR) << "Invalid interface name passthrough lookup: " << fqName;
-            return;
+static const char* kPassthroughIndexPathProperty = "hidl.passthrough.index.path";
+
+// Maps package@version (e.x. android.hardware.foo@1.0) to the passthrough
+// libraries that may implement it (<package>@<version>-impl*.so), in search
+// order. An index is never modified once built; refresh() builds a new one, so
+// lookups that already hold an index are unaffected.
+class PassthroughLibraryIndex {
+public:
+    struct Library {
+        std::string path;      // e.x. /vendor/lib64/hw/
+        std::string lib;       // e.x. android.hardware.foo@1.0-impl.so
+        std::string fullPath;  // path + lib
+    };
+
+    // Returns the process-wide index, building it on first use.
+    static std::shared_ptr<const PassthroughLibraryIndex> get() {
+        std::unique_lock<std::mutex> lock(sMutex());
+        std::shared_ptr<const PassthroughLibraryIndex>& index = sIndex();
+        if (index == nullptr) {
+            index = build();
         }
+        return index;
+    }
 
-        std::string packageAndVersion = fqName.substr(0, idx);
-        std::string ifaceName = fqName.substr(idx + strlen("::"));
+    // Rebuilds the index, e.x. after libraries have been added or removed.
+    static void refresh() {
+        std::shared_ptr<const PassthroughLibraryIndex> index = build();
+        std::unique_lock<std::mutex> lock(sMutex());
+        sIndex() = std::move(index);
+    }
 
-        const std::string prefix = packageAndVersion + "-impl";
-        const std::string sym = "HIDL_FETCH_" + ifaceName;
+    const std::vector<Library>& find(const std::string& packageAndVersion) const {
+        static const std::vector<Library> kEmpty;
+        auto it = mLibraries.find(packageAndVersion);
+        return it == mLibraries.end() ? kEmpty : it->second;
+    }
 
-        const int dlMode = RTLD_LAZY;
-        void *handle = nullptr;
+private:
+    static std::mutex& sMutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
 
-        dlerror(); // clear
+    static std::shared_ptr<const PassthroughLibraryIndex>& sIndex() {
+        static std::shared_ptr<const PassthroughLibraryIndex> index;
+        return index;
+    }
 
+    static std::vector<std::string> searchPaths() {
         std::vector<std::string> paths = {HAL_LIBRARY_PATH_ODM, HAL_LIBRARY_PATH_VENDOR,
                                           HAL_LIBRARY_PATH_VNDK_SP, HAL_LIBRARY_PATH_SYSTEM};
 #ifdef LIBHIDL_TARGET_DEBUGGABLE
@@ -291,28 +529,265 @@ struct PassthroughServiceManager : IServiceManager1_1 {
             }
         }
 #endif
+        return paths;
+    }
+
+    static std::shared_ptr<const PassthroughLibraryIndex> build() {
+        std::shared_ptr<PassthroughLibraryIndex> index = std::make_shared<PassthroughLibraryIndex>();
+        const std::vector<std::string> paths = searchPaths();
+
+        const std::string indexFile = GetProperty(kPassthroughIndexPathProperty, "");
+        if (!indexFile.empty() && index->loadFromFile(indexFile, paths)) {
+            return index;
+        }
+
+        for (const std::string& path : paths) {
+            for (const std::string& lib : search(path, "", ".so")) {
+                index->add(path, lib);
+            }
+        }
+        return index;
+    }
+
+    // Loads a precomputed list of libraries, one absolute path per line.
+    // Entries outside of the HAL library paths are ignored. Returns false if
+    // the file can't be read, in which case the directories are scanned.
+    bool loadFromFile(const std::string& file, const std::vector<std::string>& paths) {
+        std::ifstream ifs(file);
+        if (!ifs.is_open()) {
+            LOG(WARNING) << "Could not open passthrough library index " << file
+                         << ", scanning HAL library paths instead.";
+            return false;
+        }
+
+        // Group by directory so the search order matches scanning.
+        std::map<std::string, std::vector<std::string>> libsByPath;
+        for (std::string line; std::getline(ifs, line);) {
+            size_t slash = line.rfind('/');
+            if (slash == std::string::npos || !endsWith(line, ".so")) continue;
+            libsByPath[line.substr(0, slash + 1)].push_back(line.substr(slash + 1));
+        }
+
         for (const std::string& path : paths) {
-            std::vector<std::string> libs = search(path, prefix, ".so");
+            for (const std::string& lib : libsByPath[path]) {
+                add(path, lib);
+            }
+        }
+        return true;
+    }
 
-            for (const std::string &lib : libs) {
-                const std::string fullPath = path + lib;
+    void add(const std::string& path, const std::string& lib) {
+        // Package names never contain '-', so the first "-impl" ends package@version.
+        size_t implPos = lib.find("-impl");
+        if (implPos == std::string::npos || !endsWith(lib, ".so")) {
+            return;
+        }
+        mLibraries[lib.substr(0, implPos)].push_back(Library{path, lib, path + lib});
+    }
 
-                if (path != HAL_LIBRARY_PATH_SYSTEM) {
-                    handle = android_load_sphal_library(fullPath.c_str(), dlMode);
-                } else {
-                    handle = dlopen(fullPath.c_str(), dlMode);
+    std::unordered_map<std::string, std::vector<Library>> mLibraries;
+};
+
+// Keeps passthrough libraries open along with the HIDL_FETCH_* symbols
+// resolved from them, so that looking up several instances of an interface
+// dlopens and dlsyms each library once. Failures are cached as well: libraries
+// that fail to open, symbols that are missing, and, for a short while,
+// instance names a generator has returned nullptr for.
+class PassthroughLibraryCache {
+public:
+    using Generator = IBase* (*)(const char* name);
+
+    // A library opened through the cache. It is closed once it has been
+    // evicted and the last reference to it is gone, so a lookup holding a
+    // reference can keep using its handle and generators.
+    struct Library {
+        Library(const std::string& fullPath, void* handle)
+                : fullPath(fullPath), handle(handle) {}
+        ~Library() {
+            if (handle != nullptr) dlclose(handle);
+        }
+
+        const std::string fullPath;
+        void* const handle;  // nullptr if dlopen failed
+
+        // Guarded by sMutex.
+        bool providesInstances = false;
+        // HIDL_FETCH_* symbol -> generator, nullptr if not exported.
+        std::map<std::string, Generator> generators;
+        // HIDL_FETCH_* symbol -> instance names the generator returned
+        // nullptr for, and until when to trust that.
+        std::map<std::string, std::map<std::string, std::chrono::steady_clock::time_point>>
+                missingInstances;
+    };
+
+    // Returns the indexed library, opening it on first use. Returns nullptr
+    // if it can't be opened.
+    static std::shared_ptr<Library> open(const PassthroughLibraryIndex::Library& indexed) {
+        const std::string& fullPath = indexed.fullPath;
+        {
+            std::unique_lock<std::mutex> lock(sMutex());
+            auto it = sLibraries().find(fullPath);
+            if (it != sLibraries().end()) {
+                return it->second->handle != nullptr ? it->second : nullptr;
+            }
+        }
+
+        // Not holding the lock, since dlopen runs library constructors.
+        const int dlMode = RTLD_LAZY;
+        void* handle;
+
+        dlerror(); // clear
+
+        if (indexed.path != HAL_LIBRARY_PATH_SYSTEM) {
+            handle = android_load_sphal_library(fullPath.c_str(), dlMode);
+        } else {
+            handle = dlopen(fullPath.c_str(), dlMode);
+        }
+
+        if (handle == nullptr) {
+            const char* error = dlerror();
+            LOG(ERROR) << "Failed to dlopen " << indexed.lib << ": "
+                       << (error == nullptr ? "unknown error" : error);
+        }
+
+        std::shared_ptr<Library> library = std::make_shared<Library>(fullPath, handle);
+        std::unique_lock<std::mutex> lock(sMutex());
+        auto inserted = sLibraries().emplace(fullPath, library);
+        // If another thread opened the same library first, use its entry; the
+        // extra dlopen reference is dropped with ours.
+        const std::shared_ptr<Library>& cached = inserted.first->second;
+        return cached->handle != nullptr ? cached : nullptr;
+    }
+
+    // Returns sym from library. Returns nullptr if the library doesn't export
+    // sym, or if its generator recently returned nullptr for instance name.
+    static Generator getGenerator(Library* library, const std::string& sym,
+                                  const std::string& name) {
+        {
+            std::unique_lock<std::mutex> lock(sMutex());
+            auto missing = library->missingInstances.find(sym);
+            if (missing != library->missingInstances.end()) {
+                auto it = missing->second.find(name);
+                if (it != missing->second.end() &&
+                        std::chrono::steady_clock::now() < it->second) {
+                    return nullptr;
                 }
+            }
+            auto it = library->generators.find(sym);
+            if (it != library->generators.end()) {
+                return it->second;
+            }
+        }
+
+        dlerror(); // clear
+        Generator generator;
+        *(void **)(&generator) = dlsym(library->handle, sym.c_str());
+        if (!generator) {
+            const char* error = dlerror();
+            LOG(ERROR) << "Passthrough lookup opened " << library->fullPath
+                       << " but could not find symbol " << sym << ": "
+                       << (error == nullptr ? "unknown error" : error);
+        }
+
+        std::unique_lock<std::mutex> lock(sMutex());
+        library->generators[sym] = generator;
+        return generator;
+    }
 
-                if (handle == nullptr) {
-                    const char* error = dlerror();
-                    LOG(ERROR) << "Failed to dlopen " << lib << ": "
-                               << (error == nullptr ? "unknown error" : error);
+    // Records whether the generator for sym returned an instance for name.
+    // A generator may fail transiently, e.x. while its hardware comes up, so
+    // a missing instance is only remembered for kMissingInstanceTimeout.
+    static void setProvidesInstance(Library* library, const std::string& sym,
+                                    const std::string& name, bool provided) {
+        std::unique_lock<std::mutex> lock(sMutex());
+        auto& missing = library->missingInstances[sym];
+        auto it = missing.find(name);
+        if (provided) {
+            library->providesInstances = true;
+            if (it != missing.end()) {
+                missing.erase(it);
+            }
+            return;
+        }
+        const auto until = std::chrono::steady_clock::now() + kMissingInstanceTimeout;
+        if (it != missing.end()) {
+            it->second = until;
+        } else {
+            missing.emplace(name, until);
+        }
+    }
+
+    // Forgets all cached failures, and drops libraries that never provided
+    // an instance; they are closed once no lookup is using them. Libraries
+    // with live instances can't be unloaded and stay open.
+    static void evict() {
+        std::vector<std::shared_ptr<Library>> evicted;
+        {
+            std::unique_lock<std::mutex> lock(sMutex());
+            for (auto it = sLibraries().begin(); it != sLibraries().end();) {
+                Library& library = *it->second;
+                library.missingInstances.clear();
+                if (library.providesInstances) {
+                    ++it;
                     continue;
                 }
+                evicted.push_back(std::move(it->second));
+                it = sLibraries().erase(it);
+            }
+        }
+        // Not holding the lock, since dlclose runs library destructors.
+        evicted.clear();
+    }
 
-                if (!eachLib(handle, lib, sym)) {
-                    return;
-                }
+private:
+    static constexpr std::chrono::seconds kMissingInstanceTimeout{5};
+
+    static std::mutex& sMutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    // Keyed by full library path.
+    static std::map<std::string, std::shared_ptr<Library>>& sLibraries() {
+        static std::map<std::string, std::shared_ptr<Library>> libraries;
+        return libraries;
+    }
+};
+
+constexpr std::chrono::seconds PassthroughLibraryCache::kMissingInstanceTimeout;
+
+struct PassthroughServiceManager : IServiceManager1_1 {
+    static void openLibs(const std::string& fqName,
+            std::function<bool /* continue */(PassthroughLibraryCache::Library* /* library */,
+                const std::string& /* path */, const std::string& /* lib */,
+                const std::string& /* sym */)> eachLib) {
+        //fqName looks like android.hardware.foo@1.0::IFoo
+        size_t idx = fqName.find("::");
+
+        if (idx == std::string::npos ||
+                idx + strlen("::") + 1 >= fqName.size()) {
+            LOG(ERROR) << "Invalid interface name passthrough lookup: " << fqName;
+            return;
+        }
+
+        // Built once per lookup, not per candidate library.
+        const std::string packageAndVersion = fqName.substr(0, idx);
+        std::string sym = "HIDL_FETCH_";
+        sym.append(fqName, idx + strlen("::"), std::string::npos);
+
+        const std::shared_ptr<const PassthroughLibraryIndex> index =
+                PassthroughLibraryIndex::get();
+
+        for (const PassthroughLibraryIndex::Library& library : index->find(packageAndVersion)) {
+            // Held until eachLib returns, so the library isn't closed under it.
+            std::shared_ptr<PassthroughLibraryCache::Library> opened =
+                    PassthroughLibraryCache::open(library);
+            if (opened == nullptr) {
+                continue;
+            }
+
+            if (!eachLib(opened.get(), library.path, library.lib, sym)) {
+                return;
             }
         }
     }
@@ -320,27 +795,27 @@ struct PassthroughServiceManager : IServiceManager1_1 {
     Return<sp<IBase>> get(const hidl_string& fqName,
                           const hidl_string& name) override {
         sp<IBase> ret = nullptr;
-
-        openLibs(fqName, [&](void* handle, const std::string &lib, const std::string &sym) {
-            IBase* (*generator)(const char* name);
-            *(void **)(&generator) = dlsym(handle, sym.c_str());
-            if(!generator) {
-                const char* error = dlerror();
-                LOG(ERROR) << "Passthrough lookup opened " << lib
-                           << " but could not find symbol " << sym << ": "
-                           << (error == nullptr ? "unknown error" : error);
-                dlclose(handle);
-                return true;
+        const std::string interfaceName = fqName;
+        const std::string instanceName = name;
+
+        openLibs(interfaceName, [&](PassthroughLibraryCache::Library* library,
+                                    const std::string& /* path */, const std::string& /* lib */,
+                                    const std::string &sym) {
+            PassthroughLibraryCache::Generator generator =
+                    PassthroughLibraryCache::getGenerator(library, sym, instanceName);
+            if (!generator) {
+                return true; // missing symbol, or known not to provide this instance name
             }
 
             ret = (*generator)(name.c_str());
 
             if (ret == nullptr) {
-                dlclose(handle);
+                PassthroughLibraryCache::setProvidesInstance(library, sym, instanceName, false);
                 return true; // this module doesn't provide this instance name
             }
 
-            registerReference(fqName, name);
+            PassthroughLibraryCache::setProvidesInstance(library, sym, instanceName, true);
+            passthroughClientReporter().report(interfaceName, instanceName);
             return false;
         });
 
@@ -445,88 +920,396 @@ sp<IServiceManager1_1> getPassthroughServiceManager1_1() {
 
 namespace details {
 
+void refreshPassthroughLibraryIndex() {
+    PassthroughLibraryIndex::refresh();
+}
+
+void evictPassthroughLibraryCache() {
+    PassthroughLibraryCache::evict();
+}
+
+std::vector<PassthroughLibraryLoadInfo> preloadPassthroughServices(
+        const std::vector<std::string> &descriptors, size_t maxThreads) {
+    const std::shared_ptr<const PassthroughLibraryIndex> index = PassthroughLibraryIndex::get();
+
+    // Every library is loaded once, even if several descriptors share a package.
+    std::vector<const PassthroughLibraryIndex::Library*> libraries;
+    std::set<std::string> seen;
+    for (const std::string &descriptor : descriptors) {
+        size_t idx = descriptor.find("::");
+        if (idx == std::string::npos) {
+            LOG(ERROR) << "Invalid interface name passthrough preload: " << descriptor;
+            continue;
+        }
+        for (const auto &library : index->find(descriptor.substr(0, idx))) {
+            if (seen.insert(library.path + library.lib).second) {
+                libraries.push_back(&library);
+            }
+        }
+    }
+
+    std::vector<PassthroughLibraryLoadInfo> infos(libraries.size());
+    std::atomic<size_t> next{0};
+    auto worker = [&] {
+        for (size_t i; (i = next++) < libraries.size();) {
+            const PassthroughLibraryIndex::Library &library = *libraries[i];
+            auto start = std::chrono::steady_clock::now();
+            std::shared_ptr<PassthroughLibraryCache::Library> opened =
+                    PassthroughLibraryCache::open(library);
+            infos[i] = PassthroughLibraryLoadInfo{
+                .library = library.path + library.lib,
+                .loadTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start),
+                .loaded = opened != nullptr};
+            LOG(VERBOSE) << "Preloaded " << infos[i].library << " in "
+                         << infos[i].loadTime.count() << "ns";
+        }
+    };
+
+    size_t numThreads = std::min(std::max(maxThreads, static_cast<size_t>(1)), libraries.size());
+    std::vector<std::thread> threads;
+    // The calling thread is one of the workers.
+    for (size_t i = 1; i < numThreads; i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+
+    return infos;
+}
+
 void preloadPassthroughService(const std::string &descriptor) {
     PassthroughServiceManager::openLibs(descriptor,
-        [&](void* /* handle */, const std::string& /* lib */, const std::string& /* sym */) {
+        [&](PassthroughLibraryCache::Library* /* library */, const std::string& /* path */,
+            const std::string& /* lib */, const std::string& /* sym */) {
             // do nothing
             return true; // open all libs
         });
 }
 
+// Callbacks for getServiceAsync and friends, and the hwservicemanager calls
+// that set them up, run on a few shared threads: a callback usually calls
+// getService, which can block (e.x. on a dlopen or a restarting service), so
+// one slow HAL must not hold up the others or the hwbinder thread delivering
+// the notification, but a burst of lookups must not start a thread each.
+static constexpr size_t kServiceCallbackThreads = 4;
+
+static void postServiceCallback(const std::function<void()> &callback) {
+    static details::TaskRunner *runner = [] {
+        details::TaskRunner *r = new details::TaskRunner();
+        // The threads are bounded, not the queue.
+        r->start(std::numeric_limits<size_t>::max() /* limit */, kServiceCallbackThreads);
+        return r;
+    }();
+    if (!runner->push(callback)) {
+        LOG(ERROR) << "Could not schedule a service callback.";
+    }
+}
+
 struct Waiter : IServiceNotification {
-    Return<void> onRegistration(const hidl_string& /* fqName */,
-                                const hidl_string& /* name */,
+    Return<void> onRegistration(const hidl_string& fqName,
+                                const hidl_string& name,
                                 bool /* preexisting */) override {
+        std::pair<std::string, std::string> key{fqName, name};
+        std::vector<std::function<void()>> callbacks;
+
+        // Also for a registration seen before: the service may have died and
+        // come back since, while callbacks waited for it in notifyWhenRegistered.
         std::unique_lock<std::mutex> lock(mMutex);
-        if (mRegistered) {
-            return Void();
+        mRegistered[key]++;
+        auto range = mCallbacks.equal_range(key);
+        for (auto it = range.first; it != range.second; ++it) {
+            callbacks.push_back(std::move(it->second));
         }
-        mRegistered = true;
+        mCallbacks.erase(range.first, range.second);
         lock.unlock();
 
-        mCondition.notify_one();
+        mCondition.notify_all();
+        for (auto &callback : callbacks) {
+            postServiceCallback(callback);
+        }
         return Void();
     }
 
-    void wait(const std::string &interface, const std::string &instanceName) {
+    // Registers for notifications on interface/instanceName, unless this
+    // waiter is already listening for it.
+    status_t listen(const std::string &interface, const std::string &instanceName) {
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            if (mListening.count({interface, instanceName}) > 0) {
+                return OK;
+            }
+        }
+
+        const sp<IServiceManager1_1> manager = defaultServiceManager1_1();
+
+        if (manager == nullptr) {
+            LOG(ERROR) << "Could not get default service manager.";
+            return NO_INIT;
+        }
+
+        Return<bool> ret = manager->registerForNotifications(interface, instanceName, this);
+
+        if (!ret.isOk()) {
+            LOG(ERROR) << "Transport error, " << ret.description()
+                << ", during notification registration for "
+                << interface << "/" << instanceName << ".";
+            return UNKNOWN_ERROR;
+        }
+
+        if (!ret) {
+            LOG(ERROR) << "Could not register for notifications for "
+                << interface << "/" << instanceName << ".";
+            return UNKNOWN_ERROR;
+        }
+
+        std::unique_lock<std::mutex> lock(mMutex);
+        mListening.emplace(interface, instanceName);
+        return OK;
+    }
+
+    status_t wait(const std::string &interface, const std::string &instanceName) {
         using std::literals::chrono_literals::operator""s;
 
+        status_t status = waitUntil(interface, instanceName,
+                                    std::chrono::steady_clock::now() + 1s);
+        if (status != TIMED_OUT) {
+            return status;
+        }
+
+        // Only complain once; the wait below is woken up solely by onRegistration.
+        LOG(WARNING) << "Waited one second for "
+                     << interface << "/" << instanceName
+                     << ". Waiting indefinitely...";
+
         std::unique_lock<std::mutex> lock(mMutex);
-        while(true) {
-            mCondition.wait_for(lock, 1s, [this]{
-                return mRegistered;
-            });
+        mCondition.wait(lock, [&]{
+            return isRegisteredLocked(interface, instanceName);
+        });
+        return OK;
+    }
 
-            if (mRegistered) {
-                break;
+    status_t waitUntil(const std::string &interface, const std::string &instanceName,
+                       std::chrono::steady_clock::time_point deadline) {
+        status_t status = listen(interface, instanceName);
+        if (status != OK) {
+            return status;
+        }
+
+        std::unique_lock<std::mutex> lock(mMutex);
+        bool registered = mCondition.wait_until(lock, deadline, [&]{
+            return isRegisteredLocked(interface, instanceName);
+        });
+        return registered ? OK : TIMED_OUT;
+    }
+
+    // Calls callback once interface/instanceName is registered. Blocks on
+    // hwservicemanager, so it is meant to run on a service callback thread.
+    void notifyWhenRegistered(const std::string &interface, const std::string &instanceName,
+                              const std::function<void()> &callback) {
+        const Key key{interface, instanceName};
+        status_t status = listen(interface, instanceName);
+        if (status != OK) {
+            // getService fails or waits on its own, and the callback is told.
+            callback();
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(mMutex);
+        auto registered = mRegistered.find(key);
+        if (registered == mRegistered.end()) {
+            mCallbacks.emplace(key, callback);
+            return;
+        }
+        const size_t registrations = registered->second;
+        lock.unlock();
+
+        // Registered before, but the service may have died since.
+        // hwservicemanager drops dead services, so its get() tells without
+        // waiting, and without this waiter holding on to services to be told
+        // of their deaths.
+        sp<IBase> service;
+        const sp<IServiceManager1_1> manager = defaultServiceManager1_1();
+        if (manager != nullptr) {
+            Return<sp<IBase>> ret = manager->get(interface, instanceName);
+            if (ret.isOk()) {
+                service = ret;
+            }
+        }
+        if (service == nullptr) {
+            lock.lock();
+            // Unless registered again in the meantime, wait for the next
+            // registration.
+            registered = mRegistered.find(key);
+            if (registered == mRegistered.end() || registered->second == registrations) {
+                if (registered != mRegistered.end()) {
+                    mRegistered.erase(registered);
+                }
+                mCallbacks.emplace(key, callback);
+                return;
             }
+            lock.unlock();
+        }
+        callback();
+    }
+
+    // Drops every notification registration made through listen().
+    void done() {
+        std::set<std::pair<std::string, std::string>> listening;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            listening.swap(mListening);
+        }
+        if (listening.empty()) {
+            return;
+        }
+
+        const sp<IServiceManager1_1> manager = defaultServiceManager1_1();
+        if (manager == nullptr) {
+            return;
+        }
 
-            LOG(WARNING) << "Waited one second for "
-                         << interface << "/" << instanceName
-                         << ". Waiting another...";
+        for (const auto &pair : listening) {
+            if (!manager->unregisterForNotifications(pair.first, pair.second, this)
+                     .withDefault(false)) {
+                LOG(ERROR) << "Could not unregister service notification for "
+                    << pair.first << "/" << pair.second << ".";
+            }
         }
     }
 
 private:
+    using Key = std::pair<std::string, std::string>;
+
+    bool isRegisteredLocked(const std::string &interface, const std::string &instanceName) {
+        return mRegistered.count({interface, instanceName}) > 0;
+    }
+
     std::mutex mMutex;
     std::condition_variable mCondition;
-    bool mRegistered = false;
+    // (fqName, instance name) pairs that we have registered for notifications.
+    std::set<std::pair<std::string, std::string>> mListening;
+    // (fqName, instance name) pairs that have been reported as registered, and
+    // how many times.
+    std::map<Key, size_t> mRegistered;
+    // Callbacks waiting for a (fqName, instance name) pair to be registered.
+    std::multimap<Key, std::function<void()>> mCallbacks;
 };
 
 void waitForHwService(
         const std::string &interface, const std::string &instanceName) {
-    const sp<IServiceManager1_1> manager = defaultServiceManager1_1();
-
-    if (manager == nullptr) {
-        LOG(ERROR) << "Could not get default service manager.";
-        return;
-    }
+    sp<Waiter> waiter = new Waiter();
+    waiter->wait(interface, instanceName);
+    waiter->done();
+}
 
+status_t waitForHwService(
+        const std::string &interface, const std::string &instanceName,
+        std::chrono::steady_clock::time_point deadline) {
     sp<Waiter> waiter = new Waiter();
-    Return<bool> ret = manager->registerForNotifications(interface, instanceName, waiter);
+    status_t status = waiter->waitUntil(interface, instanceName, deadline);
+    waiter->done();
+    return status;
+}
 
-    if (!ret.isOk()) {
-        LOG(ERROR) << "Transport error, " << ret.description()
-            << ", during notification registration for "
-            << interface << "/" << instanceName << ".";
-        return;
+status_t notifyWhenHwServiceAvailable(const std::string &interface,
+                                      const std::string &instanceName,
+                                      const std::function<void()> &onAvailable) {
+    if (!onAvailable) {
+        return BAD_VALUE;
     }
 
-    if (!ret) {
-        LOG(ERROR) << "Could not register for notifications for "
-            << interface << "/" << instanceName << ".";
-        return;
-    }
+    // Shared by every asynchronous lookup in this process, so each
+    // interface/instance pair is registered for notifications only once.
+    // Registrations are kept for the life of the process.
+    static sp<Waiter> sWaiter = new Waiter();
+
+    // hwservicemanager may not be up yet, so even getting it can block.
+    postServiceCallback([interface, instanceName, onAvailable] {
+        const sp<IServiceManager1_1> manager = defaultServiceManager1_1();
+        if (manager == nullptr) {
+            LOG(ERROR) << "Could not get default service manager.";
+            onAvailable();
+            return;
+        }
 
-    waiter->wait(interface, instanceName);
+        Return<Transport> transport = manager->getTransport(interface, instanceName);
+        if (!transport.isOk()) {
+            LOG(ERROR) << "Transport error, " << transport.description()
+                << ", getting transport for " << interface << "/" << instanceName << ".";
+            onAvailable();
+            return;
+        }
 
-    if (!manager->unregisterForNotifications(interface, instanceName, waiter).withDefault(false)) {
-        LOG(ERROR) << "Could not unregister service notification for "
-            << interface << "/" << instanceName << ".";
-    }
+        if (transport != Transport::HWBINDER) {
+            // Never registered with hwservicemanager; getService falls back to
+            // passthrough (or fails) without waiting, so there is nothing to
+            // wait for.
+            onAvailable();
+            return;
+        }
+
+        sWaiter->notifyWhenRegistered(interface, instanceName, onAvailable);
+    });
+    return OK;
 }
 
 }; // namespace details
 
+// Sets up notifications for every service first, so all of them are
+// outstanding at once, then waits on each with waitOne.
+template<typename WaitOne>
+static status_t waitForAll(const std::vector<std::pair<std::string, std::string>> &services,
+                           WaitOne waitOne) {
+    sp<details::Waiter> waiter = new details::Waiter();
+
+    status_t status = OK;
+    for (const auto &service : services) {
+        status = waiter->listen(service.first, service.second);
+        if (status != OK) break;
+    }
+    if (status == OK) {
+        for (const auto &service : services) {
+            status = waitOne(waiter, service);
+            if (status != OK) break;
+        }
+    }
+
+    waiter->done();
+    return status;
+}
+
+status_t waitForServices(const std::vector<std::pair<std::string, std::string>> &services,
+                         std::chrono::steady_clock::time_point deadline) {
+    return waitForAll(services, [deadline](const sp<details::Waiter> &waiter,
+                                           const std::pair<std::string, std::string> &service) {
+        return waiter->waitUntil(service.first, service.second, deadline);
+    });
+}
+
+status_t waitForServices(const std::vector<std::pair<std::string, std::string>> &services) {
+    return waitForAll(services, [](const sp<details::Waiter> &waiter,
+                                   const std::pair<std::string, std::string> &service) {
+        return waiter->wait(service.first, service.second);
+    });
+}
+
+HwServiceWaiter::HwServiceWaiter() : mWaiter(new details::Waiter()) {}
+
+HwServiceWaiter::~HwServiceWaiter() {
+    mWaiter->done();
+}
+
+status_t HwServiceWaiter::wait(const std::string &interface, const std::string &instanceName) {
+    return mWaiter->wait(interface, instanceName);
+}
+
+status_t HwServiceWaiter::waitUntil(const std::string &interface, const std::string &instanceName,
+                                    std::chrono::steady_clock::time_point deadline) {
+    return mWaiter->waitUntil(interface, instanceName, deadline);
+}
+
 }; // namespace hardware
 }; // namespace android
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "AllocationStats.h"
+
+#include <sstream>
+#include <string>
+
+#include <android-base/file.h>
+
+namespace android {
+namespace hidl {
+namespace allocator {
+namespace V1_0 {
+namespace implementation {
+
+void AllocationStats::recordAllocation(uint64_t size, std::chrono::nanoseconds latency) {
+    mAllocations.fetch_add(1, std::memory_order_relaxed);
+    mBytes.fetch_add(size, std::memory_order_relaxed);
+    recordLatency(latency);
+}
+
+void AllocationStats::recordFailure(std::chrono::nanoseconds latency) {
+    mFailures.fetch_add(1, std::memory_order_relaxed);
+    recordLatency(latency);
+}
+
+void AllocationStats::recordPoolHit() {
+    mPoolHits.fetch_add(1, std::memory_order_relaxed);
+}
+
+void AllocationStats::recordLatency(std::chrono::nanoseconds latency) {
+    uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+    size_t bucket = 0;
+    while (us > 0 && bucket < kLatencyBuckets - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    mLatency[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+void AllocationStats::dump(int fd) const {
+    std::ostringstream out;
+    out << "allocations: " << mAllocations.load(std::memory_order_relaxed) << "\n"
+        << "failures: " << mFailures.load(std::memory_order_relaxed) << "\n"
+        << "pool hits: " << mPoolHits.load(std::memory_order_relaxed) << "\n"
+        << "bytes allocated: " << mBytes.load(std::memory_order_relaxed) << "\n"
+        << "latency (us):\n";
+    for (size_t i = 0; i < kLatencyBuckets; i++) {
+        uint64_t count = mLatency[i].load(std::memory_order_relaxed);
+        if (count == 0) {
+            continue;
+        }
+        uint64_t low = i == 0 ? 0 : (1ull << (i - 1));
+        if (i == kLatencyBuckets - 1) {
+            out << "    >= " << low << ": " << count << "\n";
+        } else {
+            out << "    [" << low << ", " << (1ull << i) << "): " << count << "\n";
+        }
+    }
+    android::base::WriteStringToFd(out.str(), fd);
+}
+
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace allocator
+}  // namespace hidl
+}  // namespace android
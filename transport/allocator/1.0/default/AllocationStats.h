@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HIDL_ALLOCATOR_V1_0_ALLOCATION_STATS_H
+#define ANDROID_HIDL_ALLOCATOR_V1_0_ALLOCATION_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+
+namespace android {
+namespace hidl {
+namespace allocator {
+namespace V1_0 {
+namespace implementation {
+
+// Counts what an allocator hands out, without taking locks, for debug().
+class AllocationStats {
+public:
+    void recordAllocation(uint64_t size, std::chrono::nanoseconds latency);
+    void recordFailure(std::chrono::nanoseconds latency);
+    // Counts an allocation that was served from a RegionPool.
+    void recordPoolHit();
+
+    // Writes the counters and the latency histogram to fd.
+    void dump(int fd) const;
+
+private:
+    // Bucket i counts latencies in [2^(i-1), 2^i) microseconds, with bucket 0
+    // for under 1us and the last bucket for everything above.
+    static constexpr size_t kLatencyBuckets = 20;
+
+    void recordLatency(std::chrono::nanoseconds latency);
+
+    std::atomic<uint64_t> mAllocations{0};
+    std::atomic<uint64_t> mFailures{0};
+    std::atomic<uint64_t> mPoolHits{0};
+    std::atomic<uint64_t> mBytes{0};
+    std::atomic<uint64_t> mLatency[kLatencyBuckets] = {};
+};
+
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace allocator
+}  // namespace hidl
+}  // namespace android
+
+#endif  // ANDROID_HIDL_ALLOCATOR_V1_0_ALLOCATION_STATS_H
@@ -27,73 +27,35 @@ namespace allocator {
 namespace V1_0 {
 namespace implementation {
 
-static hidl_memory allocateOne(uint64_t size) {
-    int fd = ashmem_create_region("AshmemAllocator_hidl", size);
+static int createRegion(uint64_t size) {
+    return ashmem_create_region("AshmemAllocator_hidl", size);
+}
+
+AshmemAllocator::AshmemAllocator()
+    : mPool(RegionPool::configFromProperties(), createRegion) {}
+
+hidl_memory AshmemAllocator::allocateOne(uint64_t size) {
+    auto start = std::chrono::steady_clock::now();
+    int fd = mPool.take(size);
+    if (fd >= 0) {
+        mStats.recordPoolHit();
+    } else {
+        fd = createRegion(size);
+    }
     if (fd < 0) {
+        mStats.recordFailure(std::chrono::steady_clock::now() - start);
         LOG(WARNING) << "ashmem_create_region(" << size << ") fails with " << fd;
         return hidl_memory();
     }
 
     native_handle_t* handle = native_handle_create(1, 0);
     handle->data[0] = fd;
-    LOG(WARNING) << "ashmem_create_region(" << size << ") returning hidl_memory(" << handle
+    mStats.recordAllocation(size, std::chrono::steady_clock::now() - start);
+    LOG(VERBOSE) << "ashmem_create_region(" << size << ") returning hidl_memory(" << handle
             << ", " << size << ")";
     return hidl_memory("ashmem", handle, size);
 }
 
-static void cleanup(hidl_memory&& memory) {
-    if (memory.handle() == nullptr) {
-        return;
-    }
-
-    native_handle_close(const_cast<native_handle_t *>(memory.handle()));
-    native_handle_delete(const_cast<native_handle_t *>(memory.handle()));
-}
-
-Return<void> AshmemAllocator::allocate(uint64_t size, allocate_cb _hidl_cb) {
-    hidl_memory memory = allocateOne(size);
-    _hidl_cb(memory.handle() != nullptr /* success */, memory);
-    cleanup(std::move(memory));
-
-    return Void();
-}
-
-Return<void> AshmemAllocator::batchAllocate(uint64_t size, uint64_t count, batchAllocate_cb _hidl_cb) {
-    // resize fails if count > 2^32
-    if (count > UINT32_MAX) {
-        _hidl_cb(false /* success */, {});
-        return Void();
-    }
-
-    hidl_vec<hidl_memory> batch;
-    batch.resize(count);
-
-    uint64_t allocated;
-    for (allocated = 0; allocated < count; allocated++) {
-        batch[allocated] = allocateOne(size);
-
-        if (batch[allocated].handle() == nullptr) {
-            LOG(WARNING) << "batchAllocate(" << size << ", " << count << ") fails @ #" << allocated;
-            break;
-        }
-    }
-
-    // batch[i].handle() != nullptr for i in [0, allocated - 1].
-    // batch[i].handle() == nullptr for i in [allocated, count - 1].
-
-    if (allocated < count) {
-        _hidl_cb(false /* success */, {});
-    } else {
-        _hidl_cb(true /* success */, batch);
-    }
-
-    for (uint64_t i = 0; i < allocated; i++) {
-        cleanup(std::move(batch[i]));
-    }
-
-    return Void();
-}
-
 }  // namespace implementation
 }  // namespace V1_0
 }  // namespace allocator
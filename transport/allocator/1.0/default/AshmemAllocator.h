@@ -17,9 +17,8 @@
 #ifndef ANDROID_HIDL_ASHMEM_ALLOCATOR_V1_0_ALLOCATOR_H
 #define ANDROID_HIDL_ASHMEM_ALLOCATOR_V1_0_ALLOCATOR_H
 
-#include <android/hidl/allocator/1.0/IAllocator.h>
-#include <hidl/MQDescriptor.h>
-#include <hidl/Status.h>
+#include "RegionAllocator.h"
+#include "RegionPool.h"
 
 namespace android {
 namespace hidl {
@@ -27,19 +26,14 @@ namespace allocator {
 namespace V1_0 {
 namespace implementation {
 
-using ::android::hidl::allocator::V1_0::IAllocator;
-using ::android::hardware::hidl_array;
-using ::android::hardware::hidl_memory;
-using ::android::hardware::hidl_string;
-using ::android::hardware::hidl_vec;
-using ::android::hardware::Return;
-using ::android::hardware::Void;
-using ::android::sp;
-
-struct AshmemAllocator : public IAllocator {
-    // Methods from ::android::hidl::allocator::V1_0::IAllocator follow.
-    Return<void> allocate(uint64_t size, allocate_cb _hidl_cb) override;
-    Return<void> batchAllocate(uint64_t size, uint64_t count, batchAllocate_cb _hidl_cb) override;
+struct AshmemAllocator : public RegionAllocator {
+    AshmemAllocator();
+
+protected:
+    hidl_memory allocateOne(uint64_t size) override;
+
+private:
+    RegionPool mPool;
 };
 
 }  // namespace implementation
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "BatchAllocation.h"
+
+#include <algorithm>
+#include <atomic>
+
+#include <hidl/WorkerPool.h>
+
+namespace android {
+namespace hidl {
+namespace allocator {
+namespace V1_0 {
+namespace implementation {
+
+using ::android::hardware::hidl_memory;
+using ::android::hardware::hidl_vec;
+
+// Smaller batches aren't worth starting threads for.
+static constexpr size_t kMinElementsPerThread = 8;
+
+size_t allocateBatch(hidl_vec<hidl_memory>* batch,
+                     const std::function<hidl_memory()>& allocateOne,
+                     bool stopOnFailure,
+                     size_t maxThreads) {
+    const size_t count = batch->size();
+    std::atomic<size_t> allocated(0);
+    std::atomic<bool> failed(false);
+
+    size_t threads = std::min(std::max<size_t>(maxThreads, 1),
+                              std::max<size_t>(count / kMinElementsPerThread, 1));
+    ::android::hardware::details::parallelFor(count, threads, [&](size_t i) {
+        if (stopOnFailure && failed.load(std::memory_order_relaxed)) {
+            return;
+        }
+        (*batch)[i] = allocateOne();
+        if ((*batch)[i].handle() == nullptr) {
+            failed.store(true, std::memory_order_relaxed);
+        } else {
+            allocated.fetch_add(1, std::memory_order_relaxed);
+        }
+    });
+
+    return allocated.load();
+}
+
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace allocator
+}  // namespace hidl
+}  // namespace android
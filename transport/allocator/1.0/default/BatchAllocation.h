@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HIDL_ALLOCATOR_V1_0_BATCH_ALLOCATION_H
+#define ANDROID_HIDL_ALLOCATOR_V1_0_BATCH_ALLOCATION_H
+
+#include <stddef.h>
+
+#include <functional>
+
+#include <hidl/HidlSupport.h>
+
+namespace android {
+namespace hidl {
+namespace allocator {
+namespace V1_0 {
+namespace implementation {
+
+// Fills batch by calling allocateOne for each element, on up to maxThreads
+// threads: the calling one and threads of the process-wide worker pool. A
+// failed allocation returns a hidl_memory with a null handle. With
+// stopOnFailure, no new allocations are started after one fails, so some
+// elements may not have been attempted. Returns the number of elements that
+// were allocated.
+size_t allocateBatch(::android::hardware::hidl_vec<::android::hardware::hidl_memory>* batch,
+                     const std::function<::android::hardware::hidl_memory()>& allocateOne,
+                     bool stopOnFailure,
+                     size_t maxThreads = 4);
+
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace allocator
+}  // namespace hidl
+}  // namespace android
+
+#endif  // ANDROID_HIDL_ALLOCATOR_V1_0_BATCH_ALLOCATION_H
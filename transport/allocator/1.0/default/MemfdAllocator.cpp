@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "MemfdAllocator"
+#include <android-base/logging.h>
+
+#include "MemfdAllocator.h"
+
+#include <fcntl.h>
+#include <linux/memfd.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <android-base/properties.h>
+#include <android-base/unique_fd.h>
+
+namespace android {
+namespace hidl {
+namespace allocator {
+namespace V1_0 {
+namespace implementation {
+
+using ::android::base::unique_fd;
+
+static constexpr uint64_t kHugePageSize = 2 * 1024 * 1024;
+
+// Seals that fix the size of the memory. F_SEAL_SEAL keeps the receiver from
+// removing them.
+static constexpr int kSizeSeals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
+
+static int memfdCreate(const char* name, unsigned int flags) {
+    // Not all libcs have a wrapper for this.
+    return syscall(__NR_memfd_create, name, flags);
+}
+
+static unique_fd createRegion(uint64_t size, unsigned int extraFlags) {
+    unique_fd fd(memfdCreate("MemfdAllocator_hidl", MFD_CLOEXEC | MFD_ALLOW_SEALING | extraFlags));
+    if (fd < 0) {
+        return unique_fd();
+    }
+    if (ftruncate(fd, size) != 0 || fcntl(fd, F_ADD_SEALS, kSizeSeals) != 0) {
+        return unique_fd();
+    }
+    return fd;
+}
+
+hidl_memory MemfdAllocator::allocateOne(uint64_t size) {
+    static const bool useHugetlb =
+        android::base::GetBoolProperty("hidl.allocator.memfd.hugetlb", false);
+
+    static const bool supported = isSupported();
+
+    if (!supported || size == 0 || size > static_cast<uint64_t>(INT64_MAX)) {
+        mStats.recordFailure(std::chrono::nanoseconds(0));
+        return hidl_memory();
+    }
+
+    // hugetlbfs sizes must be a multiple of the huge page size, and it may
+    // have no pages reserved, so fall back to regular pages.
+    auto start = std::chrono::steady_clock::now();
+    unique_fd fd;
+    if (useHugetlb && size % kHugePageSize == 0) {
+        fd = createRegion(size, MFD_HUGETLB);
+    }
+    if (fd < 0) {
+        fd = createRegion(size, 0);
+    }
+    if (fd < 0) {
+        mStats.recordFailure(std::chrono::steady_clock::now() - start);
+        PLOG(WARNING) << "memfd allocation of " << size << " bytes fails";
+        return hidl_memory();
+    }
+
+    native_handle_t* handle = native_handle_create(1, 0);
+    handle->data[0] = fd.release();
+    mStats.recordAllocation(size, std::chrono::steady_clock::now() - start);
+    return hidl_memory("memfd", handle, size);
+}
+
+bool MemfdAllocator::isSupported() {
+    unique_fd fd(memfdCreate("MemfdAllocator_probe", MFD_CLOEXEC));
+    return fd >= 0;
+}
+
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace allocator
+}  // namespace hidl
+}  // namespace android
@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HIDL_MEMFD_ALLOCATOR_V1_0_ALLOCATOR_H
+#define ANDROID_HIDL_MEMFD_ALLOCATOR_V1_0_ALLOCATOR_H
+
+#include "RegionAllocator.h"
+
+namespace android {
+namespace hidl {
+namespace allocator {
+namespace V1_0 {
+namespace implementation {
+
+// Allocates "memfd" memory: memfd_create files whose size is sealed, so that
+// mappers can rely on it without checking. Where the kernel doesn't support
+// memfd_create, every allocation fails.
+struct MemfdAllocator : public RegionAllocator {
+    // Whether memfd_create is supported by the running kernel.
+    static bool isSupported();
+
+protected:
+    hidl_memory allocateOne(uint64_t size) override;
+};
+
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace allocator
+}  // namespace hidl
+}  // namespace android
+
+#endif  // ANDROID_HIDL_MEMFD_ALLOCATOR_V1_0_ALLOCATOR_H
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "RegionAllocator"
+#include <android-base/logging.h>
+
+#include "RegionAllocator.h"
+#include "BatchAllocation.h"
+
+namespace android {
+namespace hidl {
+namespace allocator {
+namespace V1_0 {
+namespace implementation {
+
+void RegionAllocator::cleanup(hidl_memory&& memory) {
+    if (memory.handle() == nullptr) {
+        return;
+    }
+
+    native_handle_close(const_cast<native_handle_t *>(memory.handle()));
+    native_handle_delete(const_cast<native_handle_t *>(memory.handle()));
+}
+
+Return<void> RegionAllocator::allocate(uint64_t size, allocate_cb _hidl_cb) {
+    hidl_memory memory = allocateOne(size);
+    _hidl_cb(memory.handle() != nullptr /* success */, memory);
+    cleanup(std::move(memory));
+
+    return Void();
+}
+
+Return<void> RegionAllocator::batchAllocate(uint64_t size, uint64_t count,
+                                            batchAllocate_cb _hidl_cb) {
+    // resize fails if count > 2^32
+    if (count > UINT32_MAX) {
+        _hidl_cb(false /* success */, {});
+        return Void();
+    }
+
+    hidl_vec<hidl_memory> batch;
+    batch.resize(count);
+
+    size_t allocated = allocateBatch(&batch, [&] { return allocateOne(size); },
+                                     true /* stopOnFailure */);
+
+    if (allocated < count) {
+        LOG(WARNING) << "batchAllocate(" << size << ", " << count << ") fails after "
+                     << allocated << " allocations";
+        _hidl_cb(false /* success */, {});
+    } else {
+        _hidl_cb(true /* success */, batch);
+    }
+
+    for (uint64_t i = 0; i < count; i++) {
+        cleanup(std::move(batch[i]));
+    }
+
+    return Void();
+}
+
+Return<void> RegionAllocator::batchAllocatePartial(uint64_t size, uint64_t count,
+                                                   batchAllocatePartial_cb _hidl_cb) {
+    // resize fails if count > 2^32
+    if (count > UINT32_MAX) {
+        _hidl_cb({}, {});
+        return Void();
+    }
+
+    hidl_vec<hidl_memory> batch;
+    batch.resize(count);
+
+    allocateBatch(&batch, [&] { return allocateOne(size); },
+                  false /* stopOnFailure */);
+
+    hidl_vec<bool> success;
+    success.resize(count);
+    for (uint64_t i = 0; i < count; i++) {
+        success[i] = batch[i].handle() != nullptr;
+    }
+
+    _hidl_cb(success, batch);
+
+    for (uint64_t i = 0; i < count; i++) {
+        cleanup(std::move(batch[i]));
+    }
+
+    return Void();
+}
+
+Return<void> RegionAllocator::debug(const hidl_handle& fd,
+                                    const hidl_vec<hidl_string>& /* options */) {
+    if (fd.getNativeHandle() == nullptr || fd->numFds < 1) {
+        return Void();
+    }
+
+    mStats.dump(fd->data[0]);
+    return Void();
+}
+
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace allocator
+}  // namespace hidl
+}  // namespace android
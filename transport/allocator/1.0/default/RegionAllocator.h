@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HIDL_REGION_ALLOCATOR_V1_0_ALLOCATOR_H
+#define ANDROID_HIDL_REGION_ALLOCATOR_V1_0_ALLOCATOR_H
+
+#include <android/hidl/allocator/1.1/IAllocator.h>
+#include <hidl/MQDescriptor.h>
+#include <hidl/Status.h>
+
+#include "AllocationStats.h"
+
+namespace android {
+namespace hidl {
+namespace allocator {
+namespace V1_0 {
+namespace implementation {
+
+using ::android::hidl::allocator::V1_0::IAllocator;
+using ::android::hardware::hidl_array;
+using ::android::hardware::hidl_handle;
+using ::android::hardware::hidl_memory;
+using ::android::hardware::hidl_string;
+using ::android::hardware::hidl_vec;
+using ::android::hardware::Return;
+using ::android::hardware::Void;
+using ::android::sp;
+
+// IAllocator in terms of creating one region at a time, for allocators that
+// only differ in the kind of region they create.
+struct RegionAllocator : public ::android::hidl::allocator::V1_1::IAllocator {
+    // Methods from ::android::hidl::allocator::V1_0::IAllocator follow.
+    Return<void> allocate(uint64_t size, allocate_cb _hidl_cb) override;
+    Return<void> batchAllocate(uint64_t size, uint64_t count, batchAllocate_cb _hidl_cb) override;
+
+    // Methods from ::android::hidl::allocator::V1_1::IAllocator follow.
+    Return<void> batchAllocatePartial(uint64_t size, uint64_t count,
+                                      batchAllocatePartial_cb _hidl_cb) override;
+
+    // Methods from ::android::hidl::base::V1_0::IBase follow.
+    Return<void> debug(const hidl_handle& fd, const hidl_vec<hidl_string>& options) override;
+
+protected:
+    // Creates a region of size bytes and records it in mStats. Returns a
+    // hidl_memory with a null handle on failure. Called concurrently for
+    // batches.
+    virtual hidl_memory allocateOne(uint64_t size) = 0;
+
+    // Closes and frees the handle of memory returned by allocateOne.
+    static void cleanup(hidl_memory&& memory);
+
+    AllocationStats mStats;
+};
+
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace allocator
+}  // namespace hidl
+}  // namespace android
+
+#endif  // ANDROID_HIDL_REGION_ALLOCATOR_V1_0_ALLOCATOR_H
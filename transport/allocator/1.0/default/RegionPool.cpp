@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "RegionPool"
+#include <android-base/logging.h>
+
+#include "RegionPool.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <android-base/properties.h>
+
+namespace android {
+namespace hidl {
+namespace allocator {
+namespace V1_0 {
+namespace implementation {
+
+using ::android::base::GetUintProperty;
+
+RegionPool::Config RegionPool::configFromProperties() {
+    return Config{
+        .maxRegionsPerSize = GetUintProperty<size_t>("hidl.allocator.pool.max_regions", 16),
+        .maxBytes = GetUintProperty<uint64_t>("hidl.allocator.pool.max_bytes", 32 * 1024 * 1024),
+        .maxSizes = GetUintProperty<size_t>("hidl.allocator.pool.max_sizes", 8),
+        .period = std::chrono::milliseconds(
+            GetUintProperty<uint64_t>("hidl.allocator.pool.period_ms", 1000)),
+    };
+}
+
+RegionPool::RegionPool(const Config& config,
+                       const std::function<int(uint64_t size)>& createRegion)
+    : mConfig(config), mCreateRegion(createRegion) {
+    if (mConfig.maxRegionsPerSize > 0 && mConfig.maxBytes > 0 && mConfig.maxSizes > 0) {
+        mThread = std::thread([this] { run(); });
+    }
+}
+
+RegionPool::~RegionPool() {
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mCondition.notify_all();
+    if (mThread.joinable()) {
+        mThread.join();
+    }
+    for (auto& entry : mSizes) {
+        for (int fd : entry.second.fds) {
+            close(fd);
+        }
+    }
+}
+
+int RegionPool::take(uint64_t size) {
+    if (!mThread.joinable() || size == 0 || size > mConfig.maxBytes) {
+        return -1;
+    }
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    auto it = mSizes.find(size);
+    if (it == mSizes.end()) {
+        if (mSizes.size() >= mConfig.maxSizes) {
+            return -1;
+        }
+        it = mSizes.emplace(size, SizeClass()).first;
+    }
+    SizeClass& sizeClass = it->second;
+
+    sizeClass.requests++;
+    // Follow bursts right away rather than at the next adjustment.
+    sizeClass.target = std::max(sizeClass.target,
+                                std::min(sizeClass.requests, mConfig.maxRegionsPerSize));
+
+    int fd = -1;
+    if (!sizeClass.fds.empty()) {
+        fd = sizeClass.fds.back();
+        sizeClass.fds.pop_back();
+        mPooledBytes -= size;
+    }
+
+    mWork = true;
+    lock.unlock();
+    mCondition.notify_one();
+    return fd;
+}
+
+void RegionPool::adjustTargetsLocked() {
+    for (auto it = mSizes.begin(); it != mSizes.end();) {
+        SizeClass& sizeClass = it->second;
+        if (sizeClass.requests == 0) {
+            sizeClass.target /= 2;
+        } else {
+            sizeClass.target = std::min(sizeClass.requests, mConfig.maxRegionsPerSize);
+        }
+        sizeClass.requests = 0;
+
+        if (sizeClass.target == 0 && sizeClass.fds.empty()) {
+            it = mSizes.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+uint64_t RegionPool::nextSizeToFillLocked() const {
+    for (const auto& entry : mSizes) {
+        if (entry.second.fds.size() < entry.second.target &&
+                mPooledBytes + entry.first <= mConfig.maxBytes) {
+            return entry.first;
+        }
+    }
+    return 0;
+}
+
+void RegionPool::trimLocked(std::vector<int>* excess) {
+    for (auto it = mSizes.begin(); it != mSizes.end();) {
+        SizeClass& sizeClass = it->second;
+        while (sizeClass.fds.size() > sizeClass.target) {
+            excess->push_back(sizeClass.fds.back());
+            sizeClass.fds.pop_back();
+            mPooledBytes -= it->first;
+        }
+        // Forgotten now rather than at an adjustment that an idle pool won't make.
+        if (sizeClass.target == 0 && sizeClass.requests == 0) {
+            it = mSizes.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+bool RegionPool::idleLocked() const {
+    for (const auto& entry : mSizes) {
+        if (entry.second.target > 0 || entry.second.requests > 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void RegionPool::run() {
+    // Targets are only adjusted while there is demand or they are decaying,
+    // so an idle pool doesn't wake up every period.
+    bool adjusting = false;
+    auto nextAdjustment = std::chrono::steady_clock::time_point();
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (!mStopping) {
+        auto woken = [this] { return mWork || mStopping; };
+        if (adjusting) {
+            mCondition.wait_until(lock, nextAdjustment, woken);
+        } else {
+            mCondition.wait(lock, woken);
+        }
+        mWakeups++;
+        if (mWork && !adjusting) {
+            adjusting = true;
+            nextAdjustment = std::chrono::steady_clock::now() + mConfig.period;
+        }
+        mWork = false;
+
+        if (adjusting && std::chrono::steady_clock::now() >= nextAdjustment) {
+            adjustTargetsLocked();
+            adjusting = !idleLocked();
+            nextAdjustment = std::chrono::steady_clock::now() + mConfig.period;
+        }
+
+        std::vector<int> excess;
+        trimLocked(&excess);
+        if (!excess.empty()) {
+            lock.unlock();
+            for (int fd : excess) {
+                close(fd);
+            }
+            lock.lock();
+        }
+
+        uint64_t size;
+        while (!mStopping && (size = nextSizeToFillLocked()) != 0) {
+            lock.unlock();
+            int fd = mCreateRegion(size);
+            lock.lock();
+
+            if (fd < 0) {
+                LOG(WARNING) << "Could not create a region of " << size << " bytes for the pool.";
+                break;
+            }
+            auto it = mSizes.find(size);
+            if (it == mSizes.end()) {
+                // Forgotten in the meantime.
+                close(fd);
+                continue;
+            }
+            it->second.fds.push_back(fd);
+            mPooledBytes += size;
+        }
+    }
+}
+
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace allocator
+}  // namespace hidl
+}  // namespace android
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HIDL_ALLOCATOR_V1_0_REGION_POOL_H
+#define ANDROID_HIDL_ALLOCATOR_V1_0_REGION_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace android {
+namespace hidl {
+namespace allocator {
+namespace V1_0 {
+namespace implementation {
+
+/*
+ * Keeps freshly created regions ready for the sizes that are being asked for,
+ * so that allocation doesn't have to create them in the binder call.
+ *
+ * A background thread refills the pool. How many regions of a size are kept
+ * follows demand: a burst of requests for a size raises its target to the
+ * size of the burst, and every period without requests halves it, until the
+ * size is forgotten. Once every target is 0, the thread sleeps until the next
+ * request.
+ */
+class RegionPool {
+public:
+    struct Config {
+        // Most regions of one size to keep ready. 0 disables the pool.
+        size_t maxRegionsPerSize;
+        // Most bytes to keep ready over all sizes. Larger sizes aren't pooled.
+        uint64_t maxBytes;
+        // Most distinct sizes to track.
+        size_t maxSizes;
+        // How often targets are adjusted to demand.
+        std::chrono::milliseconds period;
+    };
+
+    // Reads the config from the hidl.allocator.pool.* properties.
+    static Config configFromProperties();
+
+    // createRegion returns a new fd of the given size, or -1.
+    RegionPool(const Config& config, const std::function<int(uint64_t size)>& createRegion);
+    ~RegionPool();
+
+    RegionPool(const RegionPool&) = delete;
+    RegionPool& operator=(const RegionPool&) = delete;
+
+    // Returns a ready region of size, or -1 if there isn't one. The caller
+    // owns the fd.
+    int take(uint64_t size);
+
+private:
+    struct SizeClass {
+        std::vector<int> fds;
+        size_t target = 0;
+        size_t requests = 0;  // since the last adjustment
+    };
+
+    friend class RegionPoolTest;
+
+    void run();
+    // Must hold mMutex.
+    void adjustTargetsLocked();
+    // Must hold mMutex. Whether there is nothing to keep ready, so targets
+    // needn't be adjusted until the next request.
+    bool idleLocked() const;
+    // Must hold mMutex. Returns a size that is below its target and fits, or 0.
+    uint64_t nextSizeToFillLocked() const;
+    // Must hold mMutex. Moves regions above their targets to excess, and
+    // forgets sizes without a target.
+    void trimLocked(std::vector<int>* excess);
+
+    const Config mConfig;
+    const std::function<int(uint64_t)> mCreateRegion;
+
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::map<uint64_t, SizeClass> mSizes;
+    uint64_t mPooledBytes = 0;
+    bool mWork = false;
+    bool mStopping = false;
+    size_t mWakeups = 0;  // of the thread, for tests
+    std::thread mThread;
+};
+
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace allocator
+}  // namespace hidl
+}  // namespace android
+
+#endif  // ANDROID_HIDL_ALLOCATOR_V1_0_REGION_POOL_H
@@ -1,6 +1,7 @@
 #define LOG_TAG "android.hidl.allocator@1.0-service"
 
 #include "AshmemAllocator.h"
+#include "MemfdAllocator.h"
 
 #include <android-base/logging.h>
 #include <android/hidl/allocator/1.0/IAllocator.h>
@@ -10,6 +11,7 @@ using android::hardware::configureRpcThreadpool;
 using android::hardware::joinRpcThreadpool;
 using android::hidl::allocator::V1_0::IAllocator;
 using android::hidl::allocator::V1_0::implementation::AshmemAllocator;
+using android::hidl::allocator::V1_0::implementation::MemfdAllocator;
 using android::sp;
 using android::status_t;
 
@@ -24,6 +26,19 @@ int main() {
         LOG(FATAL) << "Unable to register allocator service: " << status;
     }
 
+    // Registered even where memfd_create isn't supported, since the manifest
+    // declares it; its allocations fail there instead.
+    if (!MemfdAllocator::isSupported()) {
+        LOG(WARNING) << "memfd_create is not supported, memfd allocations will fail.";
+    }
+    sp<IAllocator> memfdAllocator = new MemfdAllocator();
+
+    status = memfdAllocator->registerAsService("memfd");
+
+    if (android::OK != status) {
+        LOG(FATAL) << "Unable to register memfd allocator service: " << status;
+    }
+
     joinRpcThreadpool();
 
     return -1;
@@ -19,10 +19,13 @@
 
 #include <sys/types.h>
 
+#include <map>
+
 #include <android/hidl/base/1.0/BnHwBase.h>
 #include <android/hidl/base/1.0/IBase.h>
 #include <hidl/HidlSupport.h>
 #include <hidl/HidlTransportUtils.h>
+#include <hidl/LoopbackBinder.h>
 #include <hidl/MQDescriptor.h>
 #include <hidl/Static.h>
 #include <hwbinder/IBinder.h>
@@ -59,6 +62,13 @@ status_t writeEmbeddedToParcel(const hidl_memory &memory,
 
 // ---------------------- hidl_string
 
+// In strict mode, readEmbeddedFromParcel also rejects hidl_strings that have a
+// '\0' before their end or are not well-formed UTF-8, so any hidl_string read
+// from a Parcel is known to be well-formed and needn't be scanned again.
+// Off by default; set hidl.strict_strings=true to enable it for a process.
+void setStrictStringValidation(bool enabled);
+bool isStrictStringValidationEnabled();
+
 status_t readEmbeddedFromParcel(const hidl_string &string,
         const Parcel &parcel, size_t parentHandle, size_t parentOffset);
 
@@ -180,6 +190,55 @@ template<typename T, MQFlavor flavor>
 
 // ---------------------- pointers for HIDL
 
+namespace details {
+/*
+ * Looks up pointers among the buffers already written to one Parcel, with the
+ * same results as Parcel::findBuffer. findBuffer scans every object in the
+ * Parcel, so writing a graph of n references with it is O(n^2); the index only
+ * adds the objects written since its last lookup, and finds containing buffers
+ * in an address-ordered map.
+ *
+ * This is opt-in: only writes that pass an index to writeReferenceToParcel or
+ * writeEmbeddedReferenceToParcel use it, and code generated by hidl-gen
+ * doesn't, so existing callers still go through Parcel::findBuffer.
+ *
+ * An index belongs to a single write of a single Parcel: create it for the
+ * write (e.x. on the stack), pass it to each reference written, and drop it
+ * with the write. It must not outlive the Parcel, nor be used after the
+ * Parcel is reset or has objects removed.
+ */
+class ParcelBufferIndex {
+public:
+    explicit ParcelBufferIndex(const Parcel *parcel) : mParcel(parcel) {}
+
+    ParcelBufferIndex(const ParcelBufferIndex &) = delete;
+    ParcelBufferIndex &operator=(const ParcelBufferIndex &) = delete;
+
+    // Same as parcel->findBuffer(ptr, length, found, handle, offset): of the
+    // buffers that ptr starts in, the one written first, and BAD_VALUE if
+    // ptr + length runs past its end. Also returns BAD_VALUE if parcel isn't
+    // the Parcel this index was created for.
+    status_t findBuffer(const Parcel *parcel, const void *ptr, size_t length,
+            bool *found, size_t *handle, size_t *offset);
+
+private:
+    struct Buffer {
+        uintptr_t end;
+        size_t handle;
+    };
+
+    void update();
+
+    const Parcel *const mParcel;
+    size_t mIndexedObjects = 0;
+    // Buffers can nest (e.x. a struct inside a hidl_vec's buffer), so a lookup
+    // looks back this far for buffers that contain the pointer.
+    uintptr_t mMaxLength = 0;
+    // By start address. Several buffers may start at the same address.
+    std::multimap<uintptr_t, Buffer> mBuffers;
+};
+}  // namespace details
+
 template <typename T>
 static status_t readEmbeddedReferenceFromParcel(
         T const* * /* bufptr */,
@@ -205,12 +264,15 @@ static status_t readEmbeddedReferenceFromParcel(
     return result;
 }
 
+// index, if not null, is the ParcelBufferIndex of the write in progress, and
+// makes looking for buf in parcel cheaper.
 template <typename T>
 static status_t writeEmbeddedReferenceToParcel(
         T const* buf,
         Parcel *parcel, size_t parentHandle, size_t parentOffset,
         size_t *handle,
-        bool *shouldResolveRefInBuffer
+        bool *shouldResolveRefInBuffer,
+        details::ParcelBufferIndex *index = nullptr
         ) {
 
     if(buf == nullptr) {
@@ -223,7 +285,11 @@ static status_t writeEmbeddedReferenceToParcel(
     status_t result;
     bool found;
 
-    result = parcel->findBuffer(buf, sizeof(T), &found, &childHandle, &childOffset);
+    if (index != nullptr) {
+        result = index->findBuffer(parcel, buf, sizeof(T), &found, &childHandle, &childOffset);
+    } else {
+        result = parcel->findBuffer(buf, sizeof(T), &found, &childHandle, &childOffset);
+    }
 
     // tell caller to run T::writeEmbeddedToParcel and
     // T::writeEmbeddedReferenceToParcel if necessary.
@@ -263,12 +329,14 @@ static status_t readReferenceFromParcel(
     return result;
 }
 
+// index is as for writeEmbeddedReferenceToParcel.
 template <typename T>
 static status_t writeReferenceToParcel(
         T const *buf,
         Parcel * parcel,
         size_t *handle,
-        bool *shouldResolveRefInBuffer
+        bool *shouldResolveRefInBuffer,
+        details::ParcelBufferIndex *index = nullptr
     ) {
 
     if(buf == nullptr) {
@@ -281,7 +349,11 @@ static status_t writeReferenceToParcel(
     status_t result;
     bool found;
 
-    result = parcel->findBuffer(buf, sizeof(T), &found, &childHandle, &childOffset);
+    if (index != nullptr) {
+        result = index->findBuffer(parcel, buf, sizeof(T), &found, &childHandle, &childOffset);
+    } else {
+        result = parcel->findBuffer(buf, sizeof(T), &found, &childHandle, &childOffset);
+    }
 
     // tell caller to run T::writeEmbeddedToParcel and
     // T::writeEmbeddedReferenceToParcel if necessary.
@@ -313,8 +385,9 @@ sp<IBinder> toBinder(sp<IType> iface) {
         return nullptr;
     }
     if (ifacePtr->isRemote()) {
-        return ::android::hardware::IInterface::asBinder(
-            static_cast<BpInterface<IType>*>(ifacePtr));
+        // A loopback proxy is sent as the stub behind it.
+        return details::LoopbackBinder::unwrap(::android::hardware::IInterface::asBinder(
+            static_cast<BpInterface<IType>*>(ifacePtr)));
     } else {
         std::string myDescriptor = details::getDescriptor(ifacePtr);
         if (myDescriptor.empty()) {
@@ -358,6 +431,9 @@ sp<IType> fromBinder(const sp<IBinder>& binderIface) {
     }
     sp<IBase> base = static_cast<BnHwBase*>(binderIface.get())->getImpl();
     if (details::canCastInterface(base.get(), IType::descriptor)) {
+        if (details::isLoopbackTransportEnabled()) {
+            return new ProxyType(new details::LoopbackBinder(binderIface));
+        }
         StubType* stub = static_cast<StubType*>(binderIface.get());
         return stub->getImpl();
     } else {
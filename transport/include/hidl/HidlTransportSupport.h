@@ -98,10 +98,11 @@ Return<sp<IChild>> castInterface(sp<IParent> parent, const char* childIndicator,
     if (!canCastRet) {
         return sp<IChild>(nullptr); // cast failed.
     }
-    // TODO b/32001926 Needs to be fixed for socket mode.
     if (parent->isRemote()) {
-        // binderized mode. Got BpChild. grab the remote and wrap it.
-        return sp<IChild>(new BpChild(toBinder<IParent>(parent)));
+        // binderized mode. Got BpChild. grab the remote and wrap it. The remote
+        // is taken as is, so loopback and socket proxies keep their transport.
+        return sp<IChild>(new BpChild(::android::hardware::IInterface::asBinder(
+                static_cast<BpInterface<IParent>*>(parent.get()))));
     }
     // Passthrough mode. Got BnChild and BsChild.
     return sp<IChild>(static_cast<IChild *>(parent.get()));
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HIDL_LOOPBACK_BINDER_H
+#define ANDROID_HIDL_LOOPBACK_BINDER_H
+
+#include <hwbinder/IBinder.h>
+#include <hwbinder/Parcel.h>
+#include <utils/StrongPointer.h>
+
+namespace android {
+namespace hardware {
+namespace details {
+
+// The loopback transport runs calls to binderized interfaces served by this
+// process through their proxies and stubs, i.e. through the same
+// readEmbeddedFromParcel/writeEmbeddedToParcel paths as calls between
+// processes, instead of calling the implementation directly. This is to
+// test and measure marshalling without a binder driver, e.x. on a host.
+// Off unless it is enabled here for this process, or, on debuggable builds
+// only, with hidl.loopback=true for every process.
+void setLoopbackTransportEnabled(bool enabled);
+bool isLoopbackTransportEnabled();
+
+// Replaces to's contents with a copy of from's, as the binder driver would
+// deliver it to another process: the data and every buffer it refers to are
+// copied into one allocation, and pointers from parent buffers to their
+// children are fixed up to point at the copies. File descriptors and
+// binders are passed through as they are, since both ends are this process.
+// from and to may be the same Parcel.
+status_t deliverParcel(const Parcel &from, Parcel *to);
+
+// Passes transactions to a local binder through deliverParcel, in both
+// directions. Used as the remote of a proxy to a stub in this process.
+class LoopbackBinder : public IBinder {
+public:
+    explicit LoopbackBinder(const sp<IBinder> &target);
+
+    // The stub that transactions go to.
+    const sp<IBinder> &target() const { return mTarget; }
+
+    // Returns the target of binder if it is a LoopbackBinder, else binder,
+    // so that a proxy passed back to this process is sent as its stub.
+    static sp<IBinder> unwrap(const sp<IBinder> &binder);
+
+    status_t transact(uint32_t code, const Parcel &data, Parcel *reply, uint32_t flags = 0,
+                      TransactCallback callback = nullptr) override;
+
+    status_t linkToDeath(const sp<DeathRecipient> &recipient, void *cookie = nullptr,
+                         uint32_t flags = 0) override;
+    status_t unlinkToDeath(const wp<DeathRecipient> &recipient, void *cookie = nullptr,
+                           uint32_t flags = 0,
+                           wp<DeathRecipient> *outRecipient = nullptr) override;
+
+    bool checkSubclass(const void *subclassID) const override;
+
+    void attachObject(const void *objectID, void *object, void *cleanupCookie,
+                      object_cleanup_func func) override;
+    void *findObject(const void *objectID) const override;
+    void detachObject(const void *objectID) override;
+
+private:
+    const sp<IBinder> mTarget;
+};
+
+}  // namespace details
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HIDL_LOOPBACK_BINDER_H
@@ -17,12 +17,23 @@
 #ifndef ANDROID_HARDWARE_ISERVICE_MANAGER_H
 #define ANDROID_HARDWARE_ISERVICE_MANAGER_H
 
+#include <chrono>
+#include <functional>
+#include <future>
 #include <string>
+#include <utility>
+#include <vector>
+#include <utils/Errors.h>
 #include <utils/StrongPointer.h>
 
 namespace android {
 
 namespace hidl {
+namespace base {
+namespace V1_0 {
+    struct IBase;
+}; // namespace V1_0
+}; // namespace base
 namespace manager {
 namespace V1_0 {
     struct IServiceManager;
@@ -36,6 +47,8 @@ namespace V1_1 {
 namespace hardware {
 
 namespace details {
+struct Waiter;
+
 // e.x.: android.hardware.foo@1.0, IFoo, default
 void onRegistration(const std::string &packageName,
                     const std::string &interfaceName,
@@ -44,7 +57,50 @@ void onRegistration(const std::string &packageName,
 // e.x.: android.hardware.foo@1.0::IFoo, default
 void waitForHwService(const std::string &interface, const std::string &instanceName);
 
+// Same as above, but gives up once deadline has passed. Returns OK if the
+// instance is registered, TIMED_OUT if deadline passed first, or another
+// error if notifications could not be set up.
+status_t waitForHwService(const std::string &interface, const std::string &instanceName,
+                          std::chrono::steady_clock::time_point deadline);
+
+// Calls onAvailable on one of a few background threads shared by every such
+// call once interface/instanceName is registered with hwservicemanager, or
+// right away if the instance is not served over hwbinder. hwservicemanager is
+// only contacted from those threads, so this returns without blocking, or
+// BAD_VALUE if onAvailable is empty.
+status_t notifyWhenHwServiceAvailable(const std::string &interface,
+                                      const std::string &instanceName,
+                                      const std::function<void()> &onAvailable);
+
 void preloadPassthroughService(const std::string &descriptor);
+
+// e.x.: service, android.hardware.foo@1.0::IFoo, {default, other}
+status_t registerAsServices(const sp<::android::hidl::base::V1_0::IBase> &service,
+                            const std::string &descriptor,
+                            const std::vector<std::string> &instanceNames);
+
+// Passthrough lookups use an index of the HAL library directories that is
+// built once per process. Call this after installing or removing passthrough
+// libraries to pick up the change.
+void refreshPassthroughLibraryIndex();
+
+// Passthrough libraries stay open after a lookup, along with their
+// HIDL_FETCH_* symbols and which instance names they don't provide. This
+// drops those cached results and closes libraries that never provided an
+// instance, once lookups still using them are done.
+void evictPassthroughLibraryCache();
+
+struct PassthroughLibraryLoadInfo {
+    std::string library;  // full path of the library
+    std::chrono::nanoseconds loadTime;
+    bool loaded;
+};
+
+// Loads the passthrough libraries of every descriptor (e.x.
+// android.hardware.foo@1.0::IFoo) on up to maxThreads threads, including the
+// calling thread, and returns how long each library took to load.
+std::vector<PassthroughLibraryLoadInfo> preloadPassthroughServices(
+        const std::vector<std::string> &descriptors, size_t maxThreads);
 };
 
 // These functions are for internal use by hidl. If you want to get ahold
@@ -54,6 +110,108 @@ sp<::android::hidl::manager::V1_1::IServiceManager> defaultServiceManager1_1();
 sp<::android::hidl::manager::V1_0::IServiceManager> getPassthroughServiceManager();
 sp<::android::hidl::manager::V1_1::IServiceManager> getPassthroughServiceManager1_1();
 
+/**
+ * Waits for services to be registered with hwservicemanager without polling.
+ *
+ * A single HwServiceWaiter can wait on any number of interface/instance pairs.
+ * Each pair is registered for notifications at most once, the first time it is
+ * waited on, and all registrations are dropped when the waiter is destroyed.
+ *
+ * E.x.:
+ *     HwServiceWaiter waiter;
+ *     auto deadline = std::chrono::steady_clock::now() + 5s;
+ *     waiter.waitUntil(IFoo::descriptor, "default", deadline);
+ *     waiter.waitUntil(IFoo::descriptor, "other", deadline);
+ */
+class HwServiceWaiter {
+public:
+    HwServiceWaiter();
+    ~HwServiceWaiter();
+
+    HwServiceWaiter(const HwServiceWaiter &) = delete;
+    HwServiceWaiter &operator=(const HwServiceWaiter &) = delete;
+
+    // Blocks until interface/instanceName is registered. Returns OK on
+    // registration, or an error if notifications could not be set up.
+    status_t wait(const std::string &interface, const std::string &instanceName);
+
+    // Blocks until interface/instanceName is registered or deadline passes.
+    // Returns OK on registration, TIMED_OUT if deadline passed first, or an
+    // error if notifications could not be set up.
+    status_t waitUntil(const std::string &interface, const std::string &instanceName,
+                       std::chrono::steady_clock::time_point deadline);
+
+private:
+    sp<details::Waiter> mWaiter;
+};
+
+/**
+ * Blocks until every (fully-qualified interface name, instance name) pair in
+ * services is registered. Notifications for all of them are set up before
+ * waiting on any, so the total wait is that of the slowest service.
+ *
+ * The overload with a deadline returns TIMED_OUT if it passes first.
+ *
+ * E.x.: waitForServices({{IFoo::descriptor, "default"}, {IBar::descriptor, "default"}});
+ */
+status_t waitForServices(const std::vector<std::pair<std::string, std::string>> &services);
+status_t waitForServices(const std::vector<std::pair<std::string, std::string>> &services,
+                         std::chrono::steady_clock::time_point deadline);
+
+/**
+ * Asynchronous IFoo::getService. The callback runs on one of a few background
+ * threads shared by every asynchronous lookup once the instance is available,
+ * with the result of getService (which may still be nullptr, e.g. if the
+ * service died in between). Callbacks that block hold up later ones. Returns
+ * BAD_VALUE if callback is empty.
+ *
+ * E.x.: getServiceAsync<IFoo>("default", [](const sp<IFoo>& foo) { ... });
+ */
+template<typename I>
+status_t getServiceAsync(const std::string &instanceName,
+                         const std::function<void(const sp<I> &)> &callback) {
+    if (!callback) {
+        return BAD_VALUE;
+    }
+    return details::notifyWhenHwServiceAvailable(I::descriptor, instanceName,
+        [instanceName, callback] {
+            callback(I::getService(instanceName));
+        });
+}
+
+/**
+ * Same as above, but returns a future for the service. On failure to set up
+ * the wait, the future is immediately ready with nullptr.
+ *
+ * E.x.: std::future<sp<IFoo>> foo = getServiceAsync<IFoo>();
+ */
+template<typename I>
+std::future<sp<I>> getServiceAsync(const std::string &instanceName = "default") {
+    auto promise = std::make_shared<std::promise<sp<I>>>();
+    std::future<sp<I>> future = promise->get_future();
+
+    status_t status = getServiceAsync<I>(instanceName, [promise](const sp<I> &service) {
+        promise->set_value(service);
+    });
+    if (status != OK) {
+        promise->set_value(nullptr);
+    }
+    return future;
+}
+
+/**
+ * Registers service under each of instanceNames, like calling
+ * registerAsService for each of them but doing the per-process registration
+ * bookkeeping only once. Attempts every instance and returns the first error,
+ * if any.
+ *
+ * E.x.: registerAsServices<IFoo>(foo, {"default", "other"});
+ */
+template<typename I>
+status_t registerAsServices(const sp<I> &service, const std::vector<std::string> &instanceNames) {
+    return details::registerAsServices(service, I::descriptor, instanceNames);
+}
+
 /**
  * Given a service that is in passthrough mode, this function will go ahead and load the
  * required passthrough module library (but not call HIDL_FETCH_I* functions to instantiate it).
@@ -65,6 +223,22 @@ static inline void preloadPassthroughService() {
     details::preloadPassthroughService(I::descriptor);
 }
 
+/**
+ * Same as preloadPassthroughService, but for several services at once. Their
+ * libraries are loaded concurrently on up to maxThreads threads (including the
+ * calling one). Blocks until all of them are loaded; run it on a separate
+ * thread to overlap loading with other initialization.
+ *
+ * Returns the load time of each library, so slow libraries can be spotted.
+ *
+ * E.x.: preloadPassthroughServices<IFoo, IBar>();
+ */
+template<typename... I>
+static inline std::vector<details::PassthroughLibraryLoadInfo> preloadPassthroughServices(
+        size_t maxThreads = 4) {
+    return details::preloadPassthroughServices({I::descriptor...}, maxThreads);
+}
+
 }; // namespace hardware
 }; // namespace android
 
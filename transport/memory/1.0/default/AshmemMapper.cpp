@@ -17,6 +17,7 @@
 #include "AshmemMapper.h"
 
 #include <sys/mman.h>
+#include <unistd.h>
 
 #include "AshmemMemory.h"
 
@@ -26,6 +27,52 @@ namespace memory {
 namespace V1_0 {
 namespace implementation {
 
+static constexpr size_t kHugePageSize = 2 * 1024 * 1024;
+
+// Maps mem like mmap(nullptr, size, prot, MAP_SHARED, fd, offset). Regions
+// of at least prefaultMinSize() are faulted in, and aligned for transparent
+// huge pages, so that their first use doesn't take page faults.
+static void* mapRegion(size_t size, int prot, int fd, off_t offset) {
+    size_t minSize = prefaultMinSize();
+    if (minSize == 0 || size < minSize) {
+        return mmap(0, size, prot, MAP_SHARED, fd, offset);
+    }
+
+    void* data = MAP_FAILED;
+    if (size >= kHugePageSize) {
+        // Reserve enough address space to place the mapping on a huge page
+        // boundary, and give back what is left over on either side.
+        size_t reservedSize = size + kHugePageSize;
+        void* reserved = mmap(0, reservedSize, PROT_NONE,
+                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (reserved != MAP_FAILED) {
+            uintptr_t start = reinterpret_cast<uintptr_t>(reserved);
+            uintptr_t aligned = (start + kHugePageSize - 1) & ~(kHugePageSize - 1);
+            data = mmap(reinterpret_cast<void*>(aligned), size, prot,
+                        MAP_SHARED | MAP_FIXED, fd, offset);
+            if (data == MAP_FAILED) {
+                munmap(reserved, reservedSize);
+            } else {
+                if (aligned > start) {
+                    munmap(reserved, aligned - start);
+                }
+                munmap(reinterpret_cast<void*>(aligned + size),
+                       start + reservedSize - (aligned + size));
+                madvise(data, size, MADV_HUGEPAGE);
+            }
+        }
+    }
+    if (data == MAP_FAILED) {
+        data = mmap(0, size, prot, MAP_SHARED, fd, offset);
+        if (data == MAP_FAILED) {
+            return MAP_FAILED;
+        }
+    }
+
+    prefaultPages(data, size, (prot & PROT_WRITE) != 0);
+    return data;
+}
+
 // Methods from ::android::hidl::memory::V1_0::IMapper follow.
 Return<sp<IMemory>> AshmemMapper::mapMemory(const hidl_memory& mem) {
     if (mem.handle()->numFds == 0) {
@@ -33,7 +80,7 @@ Return<sp<IMemory>> AshmemMapper::mapMemory(const hidl_memory& mem) {
     }
 
     int fd = mem.handle()->data[0];
-    void* data = mmap(0, mem.size(), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    void* data = mapRegion(mem.size(), PROT_READ|PROT_WRITE, fd, 0);
     if (data == MAP_FAILED) {
         // mmap never maps at address zero without MAP_FIXED, so we can avoid
         // exposing clients to MAP_FAILED.
@@ -43,6 +90,39 @@ Return<sp<IMemory>> AshmemMapper::mapMemory(const hidl_memory& mem) {
     return new AshmemMemory(mem, data);
 }
 
+// Methods from ::android::hidl::memory::V1_1::IMapper follow.
+Return<sp<IMemory>> AshmemMapper::mapMemoryRange(const hidl_memory& mem, uint64_t offset,
+                                                 uint64_t length, bool readOnly) {
+    if (mem.handle()->numFds == 0) {
+        return nullptr;
+    }
+
+    if (length == 0 || offset > mem.size() || length > mem.size() - offset) {
+        return nullptr;
+    }
+
+    // mmap offsets must be page aligned, so map from the start of the page
+    // containing offset and hand out a pointer into it.
+    uint64_t pageSize = static_cast<uint64_t>(getpagesize());
+    uint64_t alignedOffset = offset & ~(pageSize - 1);
+    uint64_t mappedSize = length + (offset - alignedOffset);
+    off_t mappedOffset = static_cast<off_t>(alignedOffset);
+    if (mappedSize > SIZE_MAX || mappedOffset < 0 ||
+            static_cast<uint64_t>(mappedOffset) != alignedOffset) {
+        return nullptr;
+    }
+
+    int fd = mem.handle()->data[0];
+    int prot = readOnly ? PROT_READ : PROT_READ|PROT_WRITE;
+    void* base = mapRegion(mappedSize, prot, fd, mappedOffset);
+    if (base == MAP_FAILED) {
+        return nullptr;
+    }
+
+    void* data = static_cast<uint8_t*>(base) + (offset - alignedOffset);
+    return new AshmemMemory(mem, base, mappedSize, data, length);
+}
+
 }  // namespace implementation
 }  // namespace V1_0
 }  // namespace memory
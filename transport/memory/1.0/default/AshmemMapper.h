@@ -17,7 +17,7 @@
 #ifndef ANDROID_HIDL_ASHMEM_MEMORY_V1_0_MAPPER_H
 #define ANDROID_HIDL_ASHMEM_MEMORY_V1_0_MAPPER_H
 
-#include <android/hidl/memory/1.0/IMapper.h>
+#include <android/hidl/memory/1.1/IMapper.h>
 #include <hidl/MQDescriptor.h>
 #include <hidl/Status.h>
 
@@ -27,7 +27,6 @@ namespace memory {
 namespace V1_0 {
 namespace implementation {
 
-using ::android::hidl::memory::V1_0::IMapper;
 using ::android::hidl::memory::V1_0::IMemory;
 using ::android::hardware::hidl_array;
 using ::android::hardware::hidl_memory;
@@ -37,10 +36,13 @@ using ::android::hardware::Return;
 using ::android::hardware::Void;
 using ::android::sp;
 
-struct AshmemMapper : public IMapper {
+struct AshmemMapper : public ::android::hidl::memory::V1_1::IMapper {
     // Methods from ::android::hidl::memory::V1_0::IMapper follow.
     Return<sp<IMemory>> mapMemory(const hidl_memory& mem) override;
 
+    // Methods from ::android::hidl::memory::V1_1::IMapper follow.
+    Return<sp<IMemory>> mapMemoryRange(const hidl_memory& mem, uint64_t offset, uint64_t length,
+                                       bool readOnly) override;
 };
 
 }  // namespace implementation
@@ -14,35 +14,105 @@
  * limitations under the License.
  */
 
+#include <errno.h>
 #include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+
+#include <android-base/properties.h>
 
 #include "AshmemMemory.h"
 
+// Older kernel headers don't have these. Kernels that don't support them
+// fail with EINVAL, and MADV_WILLNEED is used instead.
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ 22
+#endif
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
 namespace android {
 namespace hidl {
 namespace memory {
 namespace V1_0 {
 namespace implementation {
 
+size_t prefaultMinSize() {
+    static const size_t minSize =
+        android::base::GetUintProperty<size_t>("hidl.memory.prefault_min_size", 0);
+    return minSize;
+}
+
+void prefaultPages(void* addr, size_t length, bool write) {
+    // Set once the kernel turns out not to have MADV_POPULATE_*, so that it
+    // isn't asked again every time.
+    static std::atomic<bool> populateUnsupported(false);
+
+    if (!populateUnsupported.load(std::memory_order_relaxed)) {
+        if (madvise(addr, length, write ? MADV_POPULATE_WRITE : MADV_POPULATE_READ) == 0) {
+            return;
+        }
+        if (errno != EINVAL) {
+            return;
+        }
+        populateUnsupported.store(true, std::memory_order_relaxed);
+    }
+    // At least start reading the pages in, so the faults are minor ones.
+    madvise(addr, length, MADV_WILLNEED);
+}
+
 AshmemMemory::AshmemMemory(const hidl_memory& memory, void* data)
+  : AshmemMemory(memory, data, memory.size(), data, memory.size())
+{}
+
+AshmemMemory::AshmemMemory(const hidl_memory& memory, void* mappedBase, size_t mappedSize,
+                           void* data, uint64_t size)
   : mMemory(memory),
-    mData(data)
+    mMappedBase(mappedBase),
+    mMappedSize(mappedSize),
+    mData(data),
+    mSize(size)
 {}
 
 AshmemMemory::~AshmemMemory()
 {
     // TODO: Move implementation to mapper class
-    munmap(mData, mMemory.size());
+    munmap(mMappedBase, mMappedSize);
+}
+
+void AshmemMemory::prefaultRange(uint64_t start, uint64_t length, bool write) {
+    if (start >= mSize) {
+        return;
+    }
+    length = std::min(length, mSize - start);
+    size_t minSize = prefaultMinSize();
+    if (minSize == 0 || length < minSize) {
+        return;
+    }
+
+    uintptr_t pageMask = static_cast<uintptr_t>(getpagesize()) - 1;
+    uintptr_t begin = reinterpret_cast<uintptr_t>(mData) + start;
+    uintptr_t end = begin + length;
+    begin &= ~pageMask;
+
+    prefaultPages(reinterpret_cast<void*>(begin), end - begin, write);
 }
 
 // Methods from ::android::hidl::memory::V1_0::IMemory follow.
+// Nothing needs to be synchronized for non-remoted memory. Clients call
+// update and read around every access, so they stay free; updateRange and
+// readRange name what is about to be used, and large enough ranges are
+// faulted in now rather than on first touch.
 Return<void> AshmemMemory::update() {
     // NOOP (since non-remoted memory)
     return Void();
 }
 
-Return<void> AshmemMemory::updateRange(uint64_t /* start */, uint64_t /* length */) {
-    // NOOP (since non-remoted memory)
+Return<void> AshmemMemory::updateRange(uint64_t start, uint64_t length) {
+    prefaultRange(start, length, true /* write */);
     return Void();
 }
 
@@ -51,13 +121,15 @@ Return<void> AshmemMemory::read() {
     return Void();
 }
 
-Return<void> AshmemMemory::readRange(uint64_t /* start */, uint64_t /* length */) {
-    // NOOP (since non-remoted memory)
+Return<void> AshmemMemory::readRange(uint64_t start, uint64_t length) {
+    prefaultRange(start, length, false /* write */);
     return Void();
 }
 
 Return<void> AshmemMemory::commit() {
     // NOOP (since non-remoted memory)
+    // MADV_DONTNEED would only drop this process's page table entries for the
+    // shared pages, not their contents, so it would just cause refaults.
     return Void();
 }
 
@@ -66,7 +138,7 @@ Return<void*> AshmemMemory::getPointer() {
 }
 
 Return<uint64_t> AshmemMemory::getSize() {
-    return mMemory.size();
+    return mSize;
 }
 
 }  // namespace implementation
@@ -36,9 +36,22 @@ using ::android::hardware::Return;
 using ::android::hardware::Void;
 using ::android::sp;
 
+// Regions and ranges of at least this many bytes are faulted in ahead of use
+// (hidl.memory.prefault_min_size). 0 turns prefaulting off.
+size_t prefaultMinSize();
+
+// Faults in the pages of [addr, addr + length) ahead of use, for writing if
+// write is set. addr must be page aligned.
+void prefaultPages(void* addr, size_t length, bool write);
+
 struct AshmemMemory : public IMemory {
 
     AshmemMemory(const hidl_memory& memory, void* mappedMemory);
+
+    // For part of memory. mappedBase and mappedSize describe what was mmap'ed,
+    // data and size the part of it that was asked for.
+    AshmemMemory(const hidl_memory& memory, void* mappedBase, size_t mappedSize,
+                 void* data, uint64_t size);
     ~AshmemMemory();
 
     // Methods from ::android::hidl::memory::V1_0::IMemory follow.
@@ -51,13 +64,22 @@ struct AshmemMemory : public IMemory {
     Return<uint64_t> getSize() override;
 
 private:
+    // Calls prefaultPages on the pages covering [start, start + length) of
+    // this memory, clipped to its size, if that is at least prefaultMinSize.
+    void prefaultRange(uint64_t start, uint64_t length, bool write);
+
     // Holding onto hidl_memory reference because it contains
     // handle and size, and handle will also be required for
     // the remoted case.
     hidl_memory mMemory;
 
     // Mapped memory in process.
+    void* mMappedBase;
+    size_t mMappedSize;
+
+    // Part of the mapping this object represents.
     void* mData;
+    uint64_t mSize;
 };
 
 }  // namespace implementation
@@ -17,8 +17,10 @@
 #include "HidlFetch.h"
 
 #include "AshmemMapper.h"
+#include "MemfdMapper.h"
 
 static std::string kAshmemMemoryName = "ashmem";
+static std::string kMemfdMemoryName = "memfd";
 
 namespace android {
 namespace hidl {
@@ -31,6 +33,10 @@ IMapper* HIDL_FETCH_IMapper(const char* name) {
         return new AshmemMapper;
     }
 
+    if (name == kMemfdMemoryName) {
+        return new MemfdMapper;
+    }
+
     return nullptr;
 }
 
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "MemfdMapper.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+namespace android {
+namespace hidl {
+namespace memory {
+namespace V1_0 {
+namespace implementation {
+
+// Whether all of mem is backed by its file, now and for as long as it stays
+// mapped.
+static bool isMappable(const hidl_memory& mem) {
+    if (mem.handle()->numFds == 0) {
+        return false;
+    }
+
+    int fd = mem.handle()->data[0];
+    int seals = fcntl(fd, F_GET_SEALS);
+    if (seals < 0) {
+        // Not a memfd.
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) < mem.size()) {
+        return false;
+    }
+
+    // The size can't be checked once it's mapped, so it must not be able to
+    // shrink.
+    return (seals & F_SEAL_SHRINK) != 0;
+}
+
+// Methods from ::android::hidl::memory::V1_0::IMapper follow.
+Return<sp<IMemory>> MemfdMapper::mapMemory(const hidl_memory& mem) {
+    if (!isMappable(mem)) {
+        return nullptr;
+    }
+    return AshmemMapper::mapMemory(mem);
+}
+
+// Methods from ::android::hidl::memory::V1_1::IMapper follow.
+Return<sp<IMemory>> MemfdMapper::mapMemoryRange(const hidl_memory& mem, uint64_t offset,
+                                                uint64_t length, bool readOnly) {
+    if (!isMappable(mem)) {
+        return nullptr;
+    }
+    return AshmemMapper::mapMemoryRange(mem, offset, length, readOnly);
+}
+
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace memory
+}  // namespace hidl
+}  // namespace android
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HIDL_MEMFD_MEMORY_V1_0_MAPPER_H
+#define ANDROID_HIDL_MEMFD_MEMORY_V1_0_MAPPER_H
+
+#include "AshmemMapper.h"
+
+namespace android {
+namespace hidl {
+namespace memory {
+namespace V1_0 {
+namespace implementation {
+
+// Maps "memfd" memory. The mapping itself is the same as for ashmem. Unlike an
+// ashmem region, a memfd can shrink under a mapping, and touching the mapping
+// past the end of the file raises SIGBUS. Only memfds sealed against
+// shrinking (as MemfdAllocator makes them) are mapped, which makes one size
+// check up front sufficient.
+struct MemfdMapper : public AshmemMapper {
+    // Methods from ::android::hidl::memory::V1_0::IMapper follow.
+    Return<sp<IMemory>> mapMemory(const hidl_memory& mem) override;
+
+    // Methods from ::android::hidl::memory::V1_1::IMapper follow.
+    Return<sp<IMemory>> mapMemoryRange(const hidl_memory& mem, uint64_t offset, uint64_t length,
+                                       bool readOnly) override;
+};
+
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace memory
+}  // namespace hidl
+}  // namespace android
+
+#endif  // ANDROID_HIDL_MEMFD_MEMORY_V1_0_MAPPER_H
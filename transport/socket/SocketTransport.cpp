@@ -0,0 +1,558 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "HidlSupport"
+
+#include <hidl/SocketTransport.h>
+
+#include <android-base/logging.h>
+#include <android-base/unique_fd.h>
+#include <hwbinder/Parcel.h>
+
+#include <fcntl.h>
+#include <linux/memfd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "../FlatParcel.h"
+
+using android::base::unique_fd;
+
+namespace android {
+namespace hardware {
+namespace details {
+
+// Each transaction and each reply is one SOCK_SEQPACKET message: a
+// MessageHeader, then the flattened Parcel unless it is in a memfd, with the
+// memfd if any and then the Parcel's file descriptors attached.
+struct MessageHeader {
+    uint32_t code;  // the transaction code, or for a reply its status_t
+    uint32_t flags;
+    uint64_t dataSize;
+    uint64_t objectsCount;
+    uint64_t size;
+    uint32_t fdCount;  // not counting the memfd
+    uint32_t inMemfd;
+};
+
+// Larger Parcels go in a memfd. Small enough to fit in a default socket buffer.
+static constexpr size_t kMaxInlineSize = 32 * 1024;
+// SCM_MAX_FD
+static constexpr size_t kMaxFds = 253;
+static constexpr int kMemfdSeals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL;
+
+static status_t errnoToStatus(int error) {
+    return error == EPIPE || error == ECONNRESET ? DEAD_OBJECT : -error;
+}
+
+static int memfdCreate(const char* name, unsigned int flags) {
+    // Not all libcs have a wrapper for this.
+    return syscall(__NR_memfd_create, name, flags);
+}
+
+static status_t toAddress(const std::string &path, sockaddr_un *address, socklen_t *length) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address->sun_path)) {
+        LOG(ERROR) << "Bad socket path " << path;
+        return BAD_VALUE;
+    }
+    memcpy(address->sun_path, path.data(), path.size());
+    if (path[0] == '@') {
+        address->sun_path[0] = '\0';
+    }
+    *length = offsetof(sockaddr_un, sun_path) + path.size() + (path[0] == '@' ? 0 : 1);
+    return OK;
+}
+
+// Flattens parcel into a sealed memfd.
+static unique_fd flattenToMemfd(const Parcel &parcel, const FlatParcelLayout &layout,
+                                std::vector<int> *fds, status_t *status) {
+    unique_fd memfd(memfdCreate("hidl_socket_parcel", MFD_CLOEXEC | MFD_ALLOW_SEALING));
+    if (memfd < 0 || ftruncate(memfd, layout.size) != 0) {
+        *status = -errno;
+        return unique_fd();
+    }
+    void *block = mmap(nullptr, layout.size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (block == MAP_FAILED) {
+        *status = -errno;
+        return unique_fd();
+    }
+    *status = flattenParcel(parcel, layout, static_cast<uint8_t *>(block), fds,
+                            nullptr /* binders */);
+    munmap(block, layout.size);
+    // Sealed so that the receiver can check it in place.
+    if (*status == OK && fcntl(memfd, F_ADD_SEALS, kMemfdSeals) != 0) {
+        *status = -errno;
+    }
+    return *status == OK ? std::move(memfd) : unique_fd();
+}
+
+static status_t sendMessage(int socket, uint32_t code, uint32_t flags, const Parcel &parcel) {
+    const FlatParcelLayout layout = flatParcelLayout(parcel);
+    MessageHeader header{code, flags, layout.dataSize, layout.objectsCount, layout.size, 0,
+                         layout.size > kMaxInlineSize};
+
+    status_t status = OK;
+    std::vector<int> fds;
+    std::vector<uint8_t> block;
+    unique_fd memfd;
+    if (header.inMemfd) {
+        memfd = flattenToMemfd(parcel, layout, &fds, &status);
+        fds.insert(fds.begin(), memfd.get());
+    } else {
+        block.resize(layout.size);
+        status = flattenParcel(parcel, layout, block.data(), &fds, nullptr /* binders */);
+    }
+    if (status != OK) {
+        return status;
+    }
+    if (fds.size() > kMaxFds) {
+        LOG(ERROR) << "Can't send a Parcel with " << fds.size() << " file descriptors.";
+        return BAD_VALUE;
+    }
+    header.fdCount = fds.size() - header.inMemfd;
+
+    iovec iov[] = {
+        {&header, sizeof(header)},
+        {block.data(), block.size()},
+    };
+    msghdr message = {};
+    message.msg_iov = iov;
+    message.msg_iovlen = block.empty() ? 1 : 2;
+
+    std::vector<uint8_t> control;
+    if (!fds.empty()) {
+        control.resize(CMSG_SPACE(fds.size() * sizeof(int)));
+        message.msg_control = control.data();
+        message.msg_controllen = control.size();
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(fds.size() * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds.data(), fds.size() * sizeof(int));
+    }
+
+    if (TEMP_FAILURE_RETRY(sendmsg(socket, &message, MSG_NOSIGNAL)) < 0) {
+        return errnoToStatus(errno);
+    }
+    return OK;
+}
+
+// What a received Parcel owns until it is freed.
+struct Received {
+    ~Received() {
+        if (mapped) {
+            munmap(block, size);
+        } else {
+            free(block);
+        }
+    }
+
+    uint8_t *block = nullptr;
+    size_t size = 0;
+    bool mapped = false;
+    // As with the binder driver, the Parcel's file descriptors are closed
+    // with it; readers dup the ones they keep.
+    std::vector<unique_fd> fds;
+};
+
+static void releaseReceived(Parcel * /* parcel */, const uint8_t * /* data */,
+        size_t /* dataSize */, const binder_size_t * /* objects */, size_t /* objectsCount */,
+        void *cookie) {
+    delete static_cast<Received *>(cookie);
+}
+
+static status_t mapMemfd(int memfd, Received *received) {
+    struct stat st;
+    if (fstat(memfd, &st) != 0) {
+        return -errno;
+    }
+    // Sealed, so it can neither shrink under the mapping nor change after
+    // it has been checked.
+    const int seals = fcntl(memfd, F_GET_SEALS);
+    if (seals < 0 || (seals & (F_SEAL_SHRINK | F_SEAL_WRITE)) != (F_SEAL_SHRINK | F_SEAL_WRITE) ||
+            static_cast<uint64_t>(st.st_size) < received->size) {
+        LOG(ERROR) << "Received an unsealed or short memfd.";
+        return BAD_VALUE;
+    }
+    void *block = mmap(nullptr, received->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, memfd, 0);
+    if (block == MAP_FAILED) {
+        return -errno;
+    }
+    received->block = static_cast<uint8_t *>(block);
+    received->mapped = true;
+    return OK;
+}
+
+static status_t receiveMessage(int socket, uint32_t *code, uint32_t *flags, Parcel *parcel,
+                               std::vector<uint8_t> *scratch) {
+    MessageHeader header;
+    scratch->resize(kMaxInlineSize);
+    iovec iov[] = {
+        {&header, sizeof(header)},
+        {scratch->data(), scratch->size()},
+    };
+    union {
+        cmsghdr align;
+        uint8_t buffer[CMSG_SPACE(kMaxFds * sizeof(int))];
+    } control;
+    msghdr message = {};
+    message.msg_iov = iov;
+    message.msg_iovlen = 2;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+
+    const ssize_t length = TEMP_FAILURE_RETRY(recvmsg(socket, &message, MSG_CMSG_CLOEXEC));
+    if (length < 0) {
+        return errnoToStatus(errno);
+    }
+    if (length == 0) {
+        return DEAD_OBJECT;
+    }
+
+    std::unique_ptr<Received> received(new Received());
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg != nullptr;
+            cmsg = CMSG_NXTHDR(&message, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        const size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; i++) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            received->fds.emplace_back(fd);
+        }
+    }
+
+    if ((message.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) != 0 ||
+            static_cast<size_t>(length) < sizeof(header) || header.inMemfd > 1 ||
+            received->fds.size() != header.fdCount + header.inMemfd) {
+        LOG(ERROR) << "Received a malformed message.";
+        return BAD_VALUE;
+    }
+
+    // The sender may be a 64-bit process and this one 32-bit. Whether the
+    // sizes fit together in the block is left to unflattenParcel.
+    if (header.dataSize > SIZE_MAX || header.objectsCount > SIZE_MAX || header.size > SIZE_MAX) {
+        LOG(ERROR) << "Received a Parcel too large for this process.";
+        return BAD_VALUE;
+    }
+    const FlatParcelLayout layout{static_cast<size_t>(header.dataSize),
+                                  static_cast<size_t>(header.objectsCount),
+                                  static_cast<size_t>(header.size)};
+    received->size = layout.size;
+    status_t status = OK;
+    if (header.inMemfd) {
+        status = mapMemfd(received->fds[0], received.get());
+        received->fds.erase(received->fds.begin());
+    } else if (static_cast<size_t>(length) - sizeof(header) != layout.size) {
+        status = BAD_VALUE;
+    } else {
+        received->block = static_cast<uint8_t *>(malloc(layout.size));
+        if (received->block == nullptr && layout.size > 0) {
+            status = NO_MEMORY;
+        } else if (layout.size > 0) {
+            memcpy(received->block, scratch->data(), layout.size);
+        }
+    }
+    if (status != OK) {
+        return status;
+    }
+
+    std::vector<int> fds;
+    for (const unique_fd &fd : received->fds) {
+        fds.push_back(fd.get());
+    }
+    status = unflattenParcel(received->block, layout, &fds);
+    if (status != OK) {
+        return status;
+    }
+
+    *code = header.code;
+    *flags = header.flags;
+    uint8_t *block = received->block;
+    parcel->ipcSetDataReference(block, layout.dataSize, flatParcelObjects(block, layout),
+                                layout.objectsCount, releaseReceived, received.release());
+    return OK;
+}
+
+// The client end of a connection made by connectToSocket.
+class SocketBinder : public IBinder {
+public:
+    explicit SocketBinder(unique_fd socket) : mSocket(std::move(socket)) {}
+
+    ~SocketBinder() {
+        for (const auto &entry : mObjects) {
+            if (entry.second.func != nullptr) {
+                entry.second.func(entry.first, entry.second.object, entry.second.cleanupCookie);
+            }
+        }
+    }
+
+    status_t transact(uint32_t code, const Parcel &data, Parcel *reply, uint32_t flags = 0,
+                      TransactCallback callback = nullptr) override {
+        // One transaction at a time per connection.
+        std::unique_lock<std::mutex> lock(mMutex);
+        status_t status = sendMessage(mSocket, code, flags, data);
+        if (status != OK || (flags & FLAG_ONEWAY) != 0) {
+            return status;
+        }
+
+        Parcel ignored;
+        Parcel *out = reply != nullptr ? reply : &ignored;
+        uint32_t replyStatus;
+        uint32_t replyFlags;
+        status = receiveMessage(mSocket, &replyStatus, &replyFlags, out, &mScratch);
+        lock.unlock();
+        if (status != OK) {
+            return status;
+        }
+        if (static_cast<status_t>(replyStatus) != OK) {
+            return static_cast<status_t>(replyStatus);
+        }
+        if (callback) {
+            callback(*out);
+        }
+        return OK;
+    }
+
+    status_t linkToDeath(const sp<DeathRecipient> & /* recipient */, void * /* cookie */,
+                         uint32_t /* flags */) override {
+        return INVALID_OPERATION;
+    }
+
+    status_t unlinkToDeath(const wp<DeathRecipient> & /* recipient */, void * /* cookie */,
+                           uint32_t /* flags */, wp<DeathRecipient> * /* outRecipient */) override {
+        return INVALID_OPERATION;
+    }
+
+    void attachObject(const void *objectID, void *object, void *cleanupCookie,
+                      object_cleanup_func func) override {
+        std::unique_lock<std::mutex> lock(mObjectsMutex);
+        mObjects[objectID] = Object{object, cleanupCookie, func};
+    }
+
+    void *findObject(const void *objectID) const override {
+        std::unique_lock<std::mutex> lock(mObjectsMutex);
+        auto it = mObjects.find(objectID);
+        return it == mObjects.end() ? nullptr : it->second.object;
+    }
+
+    void detachObject(const void *objectID) override {
+        std::unique_lock<std::mutex> lock(mObjectsMutex);
+        mObjects.erase(objectID);
+    }
+
+private:
+    struct Object {
+        void *object;
+        void *cleanupCookie;
+        object_cleanup_func func;
+    };
+
+    const unique_fd mSocket;
+    std::mutex mMutex;
+    std::vector<uint8_t> mScratch;  // guarded by mMutex
+
+    mutable std::mutex mObjectsMutex;
+    std::map<const void *, Object> mObjects;
+};
+
+static void serveConnection(int socket, const sp<IBinder> &binder) {
+    std::vector<uint8_t> scratch;
+    for (;;) {
+        Parcel request;
+        uint32_t code;
+        uint32_t flags;
+        if (receiveMessage(socket, &code, &flags, &request, &scratch) != OK) {
+            return;  // The client went away, or broke the protocol.
+        }
+
+        const bool oneway = (flags & IBinder::FLAG_ONEWAY) != 0;
+        Parcel reply;
+        bool replied = false;
+        status_t sendStatus = OK;
+        status_t status = binder->transact(code, request, &reply, flags, [&](Parcel &stubReply) {
+            // Sent before the stub's callback returns, as the reply can point
+            // into its stack.
+            if (!oneway) {
+                sendStatus = sendMessage(socket, OK, 0 /* flags */, stubReply);
+            }
+            replied = true;
+        });
+        if (!oneway && !replied) {
+            const Parcel empty;
+            sendStatus = sendMessage(socket, status, 0 /* flags */, status == OK ? reply : empty);
+        }
+        if (sendStatus != OK) {
+            return;
+        }
+    }
+}
+
+class SocketServerImpl : public SocketServer {
+public:
+    SocketServerImpl(unique_fd listener, const sp<IBinder> &binder,
+                     const std::set<uid_t> &allowedUids)
+        : mListener(std::move(listener)), mBinder(binder), mAllowedUids(allowedUids) {
+        mAcceptThread = std::thread(&SocketServerImpl::acceptConnections, this);
+    }
+
+    ~SocketServerImpl() {
+        shutdown();
+    }
+
+    void shutdown() override {
+        std::unique_lock<std::mutex> lock(mMutex);
+        if (!mShutdown) {
+            mShutdown = true;
+            // Wakes up accept and recvmsg. The connections' threads close
+            // their sockets once they are done with them.
+            ::shutdown(mListener, SHUT_RDWR);
+            for (int connection : mConnections) {
+                ::shutdown(connection, SHUT_RDWR);
+            }
+        }
+        mCondition.wait(lock, [this] { return mConnections.empty(); });
+        lock.unlock();
+
+        if (mAcceptThread.joinable()) {
+            mAcceptThread.join();
+        }
+        // Frees up path for another server.
+        mListener.reset();
+    }
+
+private:
+    void acceptConnections() {
+        for (;;) {
+            unique_fd connection(TEMP_FAILURE_RETRY(accept4(mListener, nullptr, nullptr,
+                                                            SOCK_CLOEXEC)));
+            const int error = errno;
+            std::unique_lock<std::mutex> lock(mMutex);
+            if (mShutdown) {
+                return;
+            }
+            if (connection < 0) {
+                if (error == ECONNABORTED) {
+                    continue;
+                }
+                LOG(ERROR) << "Could not accept a connection: " << strerror(error);
+                return;
+            }
+
+            ucred credentials;
+            socklen_t credentialsLength = sizeof(credentials);
+            if (getsockopt(connection, SOL_SOCKET, SO_PEERCRED, &credentials,
+                           &credentialsLength) != 0) {
+                PLOG(ERROR) << "Could not get the credentials of a connection";
+                continue;
+            }
+            if (mAllowedUids.count(credentials.uid) == 0) {
+                LOG(WARNING) << "Refusing a connection from uid " << credentials.uid;
+                continue;
+            }
+
+            mConnections.insert(connection.get());
+            std::thread(&SocketServerImpl::serve, this, std::move(connection)).detach();
+        }
+    }
+
+    void serve(unique_fd connection) {
+        serveConnection(connection, mBinder);
+        // Taken out before it is closed, so that shutdown only ever shuts
+        // down open sockets.
+        std::unique_lock<std::mutex> lock(mMutex);
+        mConnections.erase(connection.get());
+        connection.reset();
+        mCondition.notify_all();
+    }
+
+    unique_fd mListener;
+    const sp<IBinder> mBinder;
+    const std::set<uid_t> mAllowedUids;
+    std::thread mAcceptThread;
+
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    bool mShutdown = false;      // guarded by mMutex
+    std::set<int> mConnections;  // guarded by mMutex, the sockets being served
+};
+
+std::unique_ptr<SocketServer> serveOnSocket(const std::string &path, const sp<IBinder> &binder) {
+    return serveOnSocket(path, binder, std::set<uid_t>{getuid()});
+}
+
+std::unique_ptr<SocketServer> serveOnSocket(const std::string &path, const sp<IBinder> &binder,
+                                            const std::set<uid_t> &allowedUids) {
+    sockaddr_un address;
+    socklen_t addressLength;
+    if (toAddress(path, &address, &addressLength) != OK) {
+        return nullptr;
+    }
+
+    unique_fd listener(socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0));
+    if (listener < 0) {
+        PLOG(ERROR) << "Could not create a socket";
+        return nullptr;
+    }
+    if (path[0] != '@') {
+        unlink(path.c_str());
+    }
+    if (bind(listener, reinterpret_cast<const sockaddr *>(&address), addressLength) != 0 ||
+            listen(listener, SOMAXCONN) != 0) {
+        PLOG(ERROR) << "Could not listen on " << path;
+        return nullptr;
+    }
+    return std::unique_ptr<SocketServer>(
+            new SocketServerImpl(std::move(listener), binder, allowedUids));
+}
+
+sp<IBinder> connectToSocket(const std::string &path) {
+    sockaddr_un address;
+    socklen_t addressLength;
+    if (toAddress(path, &address, &addressLength) != OK) {
+        return nullptr;
+    }
+
+    unique_fd connection(socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0));
+    if (connection < 0 ||
+            TEMP_FAILURE_RETRY(connect(connection, reinterpret_cast<const sockaddr *>(&address),
+                                       addressLength)) != 0) {
+        PLOG(ERROR) << "Could not connect to " << path;
+        return nullptr;
+    }
+    return new SocketBinder(std::move(connection));
+}
+
+}  // namespace details
+}  // namespace hardware
+}  // namespace android
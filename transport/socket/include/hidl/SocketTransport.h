@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HIDL_SOCKET_TRANSPORT_H
+#define ANDROID_HIDL_SOCKET_TRANSPORT_H
+
+#include <hwbinder/IBinder.h>
+#include <sys/types.h>
+#include <utils/StrongPointer.h>
+
+#include <memory>
+#include <set>
+#include <string>
+
+namespace android {
+namespace hardware {
+namespace details {
+
+// A transport over Unix domain sockets, for running services and clients
+// where there is no binder driver, e.x. on a Linux host or in a container.
+// Each transaction is flattened as the driver would copy it, see
+// deliverParcel; file descriptors are passed with SCM_RIGHTS, and Parcels
+// too large for one message are passed in a sealed memfd. Binders can't be
+// passed, and there are no death notifications.
+//
+// A path starting with '@' names a socket in the abstract namespace.
+//
+// This is libhidlsocket, a static library, not part of libhidltransport:
+// toBinder, fromBinder and configureRpcThreadpool never select it, so it is
+// only used through serveOnSocket and connectToSocket below.
+
+// A binder being served on a socket, until it is shut down or destroyed.
+class SocketServer {
+public:
+    virtual ~SocketServer() {}
+
+    // Stops accepting connections and closes the ones being served, once the
+    // transactions in progress on them are done. Must not be called from one
+    // of those transactions.
+    virtual void shutdown() = 0;
+};
+
+// Serves binder, e.x. toBinder<IFoo>(service), to clients connecting to the
+// socket at path. Each connection is served on its own thread. Only clients
+// running as one of allowedUids are served, by default only those running
+// as this process's uid. Returns nullptr on failure.
+std::unique_ptr<SocketServer> serveOnSocket(const std::string &path, const sp<IBinder> &binder);
+std::unique_ptr<SocketServer> serveOnSocket(const std::string &path, const sp<IBinder> &binder,
+                                            const std::set<uid_t> &allowedUids);
+
+// Connects to a binder served with serveOnSocket, to be used as the remote
+// of a proxy, e.x. fromBinder<IFoo, BpHwFoo, BnHwFoo>(connectToSocket(path)).
+// Returns nullptr on failure.
+sp<IBinder> connectToSocket(const std::string &path);
+
+}  // namespace details
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HIDL_SOCKET_TRANSPORT_H
@@ -2,10 +2,12 @@
 
 packages=(
     android.hidl.allocator@1.0
+    android.hidl.allocator@1.1
     android.hidl.base@1.0
     android.hidl.manager@1.0
     android.hidl.manager@1.1
     android.hidl.memory@1.0
+    android.hidl.memory@1.1
     android.hidl.token@1.0
 )
 